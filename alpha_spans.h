@@ -0,0 +1,122 @@
+#ifndef ALPHA_SPANS_H
+#define ALPHA_SPANS_H
+
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Строки листа, разложенные на отрезки по альфе. Лист аватара почти весь либо
+// полностью прозрачный, либо полностью непрозрачный: прозрачное можно не трогать,
+// непрозрачное - копировать без смешивания, и только края требуют честного смешивания.
+
+enum class AlphaRunKind : uint8_t {
+    Transparent, // альфа 0
+    Opaque,      // альфа 255
+    Partial
+};
+
+// Отрезок строки; начинается там, где закончился предыдущий
+struct AlphaRun {
+    int32_t end = 0;
+    AlphaRunKind kind = AlphaRunKind::Transparent;
+};
+
+/**
+ * @brief AlphaSpanIndex Отрезки прозрачности для каждой строки одного уровня листа
+ *
+ * Не зависит от порядка каналов: при конвертации листа в формат окна остаётся верным.
+ */
+struct AlphaSpanIndex {
+    int w = 0, h = 0;
+    std::vector<uint32_t> rowStart; // h + 1 смещений в runs
+    std::vector<AlphaRun> runs;
+
+    const AlphaRun* begin(int y) const { return runs.data() + rowStart[y]; }
+    const AlphaRun* end(int y) const { return runs.data() + rowStart[y + 1]; }
+
+    // Отрезок строки y, в который попадает столбец x
+    const AlphaRun* find(int y, int x) const {
+        return std::upper_bound(begin(y), end(y), x, [](int v, const AlphaRun& r) { return v < r.end; });
+    }
+
+    size_t bytes() const { return rowStart.size() * sizeof(uint32_t) + runs.size() * sizeof(AlphaRun); }
+};
+
+static void buildAlphaSpanIndex(AlphaSpanIndex& idx, const SDL_Surface* surf, int alphaShift) {
+    idx.w = surf->w;
+    idx.h = surf->h;
+    idx.rowStart.assign(1, 0);
+    idx.runs.clear();
+    const int pitch = surf->pitch / static_cast<int>(sizeof(Uint32));
+    for (int y = 0; y < surf->h; ++y) {
+        const Uint32* row = static_cast<const Uint32*>(surf->pixels) + y * pitch;
+        for (int x = 0; x < surf->w;) {
+            const Uint32 a = (row[x] >> alphaShift) & 0xFF;
+            const AlphaRunKind kind = a == 0 ? AlphaRunKind::Transparent
+                                    : a == 255 ? AlphaRunKind::Opaque : AlphaRunKind::Partial;
+            int end = x + 1;
+            if (kind == AlphaRunKind::Partial) {
+                while (end < surf->w) {
+                    const Uint32 b = (row[end] >> alphaShift) & 0xFF;
+                    if (b == 0 || b == 255) break;
+                    ++end;
+                }
+            }
+            else {
+                while (end < surf->w && ((row[end] >> alphaShift) & 0xFF) == a) ++end;
+            }
+            idx.runs.push_back({ end, kind });
+            x = end;
+        }
+        idx.rowStart.push_back(static_cast<uint32_t>(idx.runs.size()));
+    }
+}
+
+// Вызывает fn(a, b) для отрезков [a, b) внутри [lo, hi], прозрачных в обеих строках y0 и y1
+// (для билинейной выборки; y0 == y1 - одна строка)
+template <typename Fn>
+static void forEachTransparentRun(const AlphaSpanIndex& idx, int y0, int y1, int lo, int hi, Fn&& fn) {
+    const AlphaRun* p = idx.find(y0, lo);
+    const AlphaRun* q = idx.find(y1, lo);
+    const AlphaRun* pEnd = idx.end(y0);
+    const AlphaRun* qEnd = idx.end(y1);
+    int x = lo;
+    int open = -1; // начало текущего общего прозрачного отрезка
+    while (x <= hi && p != pEnd && q != qEnd) {
+        const int end = std::min(p->end, q->end);
+        const bool clear = p->kind == AlphaRunKind::Transparent && q->kind == AlphaRunKind::Transparent;
+        if (clear && open < 0) open = x;
+        if (!clear && open >= 0) {
+            fn(open, x);
+            open = -1;
+        }
+        x = end;
+        if (p->end == end) ++p;
+        if (q->end == end) ++q;
+    }
+    if (open >= 0) fn(open, std::min(x, hi + 1));
+}
+
+/**
+ * @brief transparentDestRange Пиксели строки назначения, чьи выборки целиком лежат в прозрачном [a, b)
+ *
+ * Пиксель i читает столбцы clamp(x0 .. x0 + taps - 1, minX, maxX), где x0 = (u + i * du) >> 16:
+ * taps = 1 для ближайшего соседа, 2 для билинейки. Результат - [first, last) внутри [0, count).
+ */
+static void transparentDestRange(int32_t u, int32_t du, int count, int a, int b, int minX, int maxX, int taps,
+                                 int& first, int& last) {
+    constexpr int64_t one = 1 << 16;
+    const int64_t lo = a <= minX ? INT64_MIN / 4 : static_cast<int64_t>(a) * one;        // u_i >= lo
+    const int64_t hi = b > maxX ? INT64_MAX / 4 : static_cast<int64_t>(b - taps + 1) * one; // u_i < hi
+    auto firstAtLeast = [&](int64_t bound) -> int64_t {
+        const int64_t d = bound - u;
+        if (d <= 0) return 0;
+        return (d + du - 1) / du;
+    };
+    first = static_cast<int>(std::min<int64_t>(count, firstAtLeast(lo)));
+    last = static_cast<int>(std::min<int64_t>(count, firstAtLeast(hi)));
+    if (last < first) last = first;
+}
+
+#endif // ALPHA_SPANS_H
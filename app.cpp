@@ -6,7 +6,6 @@ namespace fs = std::filesystem;
 const std::string APP_NAME = "PNGPill";
 
 
-// todo: hot reload
 static void createDefaultConfig(const fs::path& path) {
     std::ofstream file(path);
     if (!file.is_open()) return;
@@ -17,20 +16,51 @@ static void createDefaultConfig(const fs::path& path) {
         << "micName = default\n"
         << "micThreshold = 0.0075\n"
         << "micGain = 1.0\n"
+        << "micHysteresis = 0.6\n"
+        << "micAttackMs = 5\n"
+        << "micReleaseMs = 60\n"
+        << "micHopMs = 5\n"
+        << "micAutoCalibrate = false\n"
+        << "visemes = true\n"
         << "spriteDir = \n"
         << "enableBreathing = true\n"
         << "enableShaking = true\n"
         << "shakingAmplitude = 1.0\n"
         << "shakingFrequency = 1.0\n" // силу дыхания звбыл
         << "fps = 60\n"
-        << "spriteAlignment = AsIs";
+        << "vsync = false\n"
+        << "spriteAlignment = AsIs\n"
+        << "useCpuRendering = false\n"
+        << "headless = false\n"
+        << "numberOfThreadsForCpuRender = -1\n"
+        << "cpuFilter = Bilinear\n"
+        << "frameCacheMB = 0\n"
+        << "spriteCache = true\n"
+        << "spriteBudgetMB = 0\n"
+        << "spritePrefetch = 3\n"
+        << "spriteAtlas = false\n"
+        << "hotReload = true\n"
+        << "idleSleep = true\n"
+        << "latencyProbe = false\n"
+        << "stageLog = \n"
+        << "font = ";
 }
 
 static SpriteAlignment parseAlignment(std::string str) {
     if (str == "Centered") return SpriteAlignment::Centered;
+    if (str == "Centroid") return SpriteAlignment::Centroid;
     return SpriteAlignment::AsIs;
 }
 
+static CpuFilter parseCpuFilter(std::string str) {
+    if (str == "Nearest") return CpuFilter::Nearest;
+    if (str == "Box") return CpuFilter::Box;
+    if (str == "Triangle") return CpuFilter::Triangle;
+    if (str == "Bicubic") return CpuFilter::Bicubic;
+    if (str == "Lanczos") return CpuFilter::Lanczos;
+    return CpuFilter::Bilinear;
+}
+
 static AppConfig loadConfig(const fs::path& dir) {
     auto cfgPath = dir / "config.ini";
     if (!fs::exists(cfgPath)) {
@@ -54,6 +84,12 @@ static AppConfig loadConfig(const fs::path& dir) {
         else if (key == "micName") cfg.micName = val;
         else if (key == "micThreshold") cfg.micThreshold = std::stof(val);
         else if (key == "micGain")      cfg.micGain = std::stof(val);
+        else if (key == "micHysteresis") cfg.micHysteresis = std::stof(val);
+        else if (key == "micAttackMs") cfg.micAttackMs = std::stof(val);
+        else if (key == "micReleaseMs") cfg.micReleaseMs = std::stof(val);
+        else if (key == "micHopMs") cfg.micHopMs = std::stoi(val);
+        else if (key == "micAutoCalibrate") cfg.micAutoCalibrate = parseBool(val);
+        else if (key == "visemes")      cfg.visemes = parseBool(val);
         else if (key == "spriteDir")    cfg.spriteDir = val;
         else if (key == "enableBreathing") cfg.enableBreathing = parseBool(val);
         else if (key == "breathingAmplitude") cfg.breathingAmp = stof(val);
@@ -62,11 +98,47 @@ static AppConfig loadConfig(const fs::path& dir) {
         else if (key == "shakingAmplitude") cfg.shakingAmp = std::stof(val);
         else if (key == "shakingFrequency") cfg.shakingFreq = std::stof(val);
         else if (key == "fps")          cfg.fps = std::stoi(val);
+        else if (key == "vsync")        cfg.vsync = parseBool(val);
         else if (key == "spriteAlignment") cfg.alignment = parseAlignment(val);
+        else if (key == "useCpuRendering") cfg.useCpuRendering = parseBool(val);
+        else if (key == "headless") cfg.headless = parseBool(val);
+        else if (key == "numberOfThreadsForCpuRender") cfg.numberOfThreadsForCpuRender = std::stoi(val);
+        else if (key == "cpuFilter") cfg.cpuFilter = parseCpuFilter(val);
+        else if (key == "frameCacheMB") cfg.frameCacheMB = std::stoi(val);
+        else if (key == "spriteCache") cfg.spriteCache = parseBool(val);
+        else if (key == "spriteBudgetMB") cfg.spriteBudgetMB = std::stoi(val);
+        else if (key == "spritePrefetch") cfg.spritePrefetch = std::stoi(val);
+        else if (key == "spriteAtlas") cfg.spriteAtlas = parseBool(val);
+        else if (key == "hotReload") cfg.hotReload = parseBool(val);
+        else if (key == "idleSleep") cfg.idleSleep = parseBool(val);
+        else if (key == "latencyProbe") cfg.latencyProbe = parseBool(val);
+        else if (key == "stageLog") cfg.stageLogPath = val;
+        else if (key == "font") cfg.fontPath = val;
+        else if (key == "usebilinearinterpolationoncpu" && !parseBool(val)) cfg.cpuFilter = CpuFilter::Nearest; // старое имя
+    }
+    if (cfg.spriteCache) cfg.spriteCachePath = (dir / "sprites.cache").string();
+    cfg.latencyLogPath = (dir / "latency.txt").string();
+    if (!cfg.stageLogPath.empty() && fs::path(cfg.stageLogPath).is_relative()) {
+        cfg.stageLogPath = (dir / cfg.stageLogPath).string();
+    }
+    if (!cfg.fontPath.empty() && fs::path(cfg.fontPath).is_relative()) {
+        cfg.fontPath = (dir / cfg.fontPath).string();
     }
     return cfg;
 }
 
+static VadParams vadParamsFrom(const AppConfig& cfg) {
+    VadParams p;
+    p.threshold = cfg.micThreshold;
+    p.gain = cfg.micGain;
+    p.hysteresis = cfg.micHysteresis;
+    p.attackMs = cfg.micAttackMs;
+    p.releaseMs = cfg.micReleaseMs;
+    p.hopMs = cfg.micHopMs;
+    p.autoCalibrate = cfg.micAutoCalibrate;
+    return p;
+}
+
 static SDL_AudioDeviceID findMicByName(const std::string& name) {
     int num = 0;
     SDL_AudioDeviceID* devices = SDL_GetAudioRecordingDevices(&num);
@@ -91,11 +163,250 @@ static SDL_AudioDeviceID findMicByName(const std::string& name) {
 }
 
 
+// "face@4x2" -> имя "face", сетка 4x2; без суффикса (или с негодным) - сетка 2x2
+static void parseSpriteGrid(const std::string& stem, std::string& name, int& cols, int& rows) {
+    name = stem;
+    cols = rows = 2;
+    const size_t at = stem.rfind('@');
+    if (at == std::string::npos || at == 0) return;
+    int c = 0, r = 0;
+    char tail = 0;
+    if (std::sscanf(stem.c_str() + at + 1, "%dx%d%c", &c, &r, &tail) != 2) return;
+    if (c < 1 || r < 1 || c * r > MAX_SPRITE_FRAMES) return;
+    name = stem.substr(0, at);
+    cols = c;
+    rows = r;
+}
+
+// Цепочка уровней строится, пока кадры делятся пополам без остатка:
+// так ни один уровень не смешивает пиксели соседних кадров
+static void buildSpriteMips(SpriteList& s) {
+    constexpr int MIN_MIP_QUAD = 16;
+    SDL_Surface* prev = s.surface;
+    while (true) {
+        int quadW = prev->w / s.cols;
+        int quadH = prev->h / s.rows;
+        if (quadW * s.cols != prev->w || quadH * s.rows != prev->h) break;
+        if (quadW % 2 != 0 || quadH % 2 != 0) break;
+        if (quadW / 2 < MIN_MIP_QUAD || quadH / 2 < MIN_MIP_QUAD) break;
+        SDL_Surface* next = downsampleHalf(prev);
+        if (!next) break;
+        s.mips.push_back(next);
+        prev = next;
+    }
+}
+
+// Отрезки альфы всех уровней для CPU-композитора (прозрачное пропускается, непрозрачное копируется)
+static void indexSpriteAlpha(SpriteList& s) {
+    if (!s.surface) return;
+    const int alphaShift = SDL_GetPixelFormatDetails(s.surface->format)->Ashift;
+    s.alphaSpans.resize(1 + s.mips.size());
+    buildAlphaSpanIndex(s.alphaSpans[0], s.surface, alphaShift);
+    for (size_t i = 0; i < s.mips.size(); ++i) {
+        buildAlphaSpanIndex(s.alphaSpans[i + 1], s.mips[i], alphaShift);
+    }
+}
+
+static void indexSpritesAlpha(std::vector<SpriteList>& sprites, ThreadPool* pool) {
+    auto indexOne = [&](size_t i) { indexSpriteAlpha(sprites[i]); };
+    if (pool) pool->run(sprites.size(), indexOne);
+    else for (size_t i = 0; i < sprites.size(); ++i) indexOne(i);
+}
+
+/**
+ * @brief SpriteLoadResult Результат загрузки одного листа (заполняется в своём потоке)
+ */
+struct SpriteLoadResult {
+    bool ok = false;
+    SpriteList sprite;
+    std::string error;
+    double decodeMs = 0.0;   // IMG_Load
+    double prepareMs = 0.0;  // конвертация, предумножение, центровка, мипы
+};
+
+static double elapsedMs(Uint64 from, Uint64 to) {
+    return 1000.0 * static_cast<double>(to - from) / static_cast<double>(SDL_GetPerformanceFrequency());
+}
+
+// Декодирует и подготавливает один лист. Не трогает общие данные, поэтому зовётся из пула
+static void decodeSprite(const fs::path& path, SDL_PixelFormat spriteFormat, int alphaShift,
+                         SpriteAlignment alignment, SpriteLoadResult& result) {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    SDL_Surface* surf = IMG_Load(path.string().c_str());
+    Uint64 t1 = SDL_GetPerformanceCounter();
+    result.decodeMs = elapsedMs(t0, t1);
+    if (!surf) {
+        result.error = "Failed to load " + path.string();
+        return;
+    }
+
+    // Один формат на все листы: порядок каналов как у окна, альфа предумножена.
+    // Тогда рендеру не нужно декодировать пиксели, а билинейка не даёт ореолов по краям
+    SDL_Surface* normalized = SDL_ConvertSurface(surf, spriteFormat);
+    SDL_DestroySurface(surf);
+    if (!normalized || !SDL_PremultiplySurfaceAlpha(normalized, false)) {
+        result.error = "Failed to normalize " + path.string() + ": " + SDL_GetError();
+        if (normalized) SDL_DestroySurface(normalized);
+        return;
+    }
+    surf = normalized;
+
+    SpriteList& s = result.sprite;
+    s.surface = surf;
+    s.tex = nullptr;
+    s.w = surf->w;
+    s.h = surf->h;
+    parseSpriteGrid(path.stem().string(), s.name, s.cols, s.rows);
+    s.sourcePath = path.string();
+
+    if (alignment == SpriteAlignment::Centered || alignment == SpriteAlignment::Centroid) {
+        const uint32_t* pixels = static_cast<const uint32_t*>(surf->pixels);
+        int pitch = surf->pitch / sizeof(uint32_t);
+
+        int quadW = surf->w / s.cols;
+        int quadH = surf->h / s.rows;
+
+        for (int fy = 0; fy < s.rows; ++fy) {
+            for (int fx = 0; fx < s.cols; ++fx) {
+                int idx = fy * s.cols + fx;
+                const uint32_t* quad = pixels + fy * quadH * pitch + fx * quadW;
+
+                AlphaBounds bounds = findAlphaBounds(quad, pitch, quadW, quadH, alphaShift);
+                if (bounds.empty()) continue;
+
+                float current_center_x = (bounds.minX + bounds.maxX) * 0.5f;
+                float current_center_y = (bounds.minY + bounds.maxY) * 0.5f;
+                if (alignment == SpriteAlignment::Centroid) {
+                    alphaCentroid(quad, pitch, bounds, alphaShift, current_center_x, current_center_y);
+                }
+                float quad_center_x = quadW * 0.5f;
+                float quad_center_y = quadH * 0.5f;
+
+                s.baseOffsetX[idx] = quad_center_x - current_center_x;
+                s.baseOffsetY[idx] = quad_center_y - current_center_y;
+            }
+        }
+    }
+
+    buildSpriteMips(s);
+
+    result.prepareMs = elapsedMs(t1, SDL_GetPerformanceCounter());
+    result.ok = true;
+}
+
+// Поверхности листа поверх записи кэша; пиксели не копируются, рендер их только читает
+static bool mapCachedSprite(const SpriteCacheEntry& e, SDL_PixelFormat spriteFormat, SpriteList& s) {
+    for (const SpriteCacheLevel& level : e.levels) {
+        SDL_Surface* surf = SDL_CreateSurfaceFrom(level.w, level.h, spriteFormat,
+                                                  const_cast<void*>(level.pixels), level.pitch);
+        if (!surf) break;
+        if (!s.surface) s.surface = surf;
+        else s.mips.push_back(surf);
+    }
+    return s.surface != nullptr;
+}
+
+static void releaseCachedPages(const SpriteList& s) {
+    if (s.cacheEntry < 0 || !s.pixelStore) return;
+    static_cast<const SpriteCache*>(s.pixelStore.get())->release(static_cast<size_t>(s.cacheEntry));
+}
+
+// Сверяет исходники с sprites.cache и, если всё совпало, берёт листы прямо из отображения файла.
+// sources заполняется в любом случае - по нему потом пишется новый кэш.
+// lazy - отображается только первый лист, остальные остаются пустыми до подгрузки (spriteBudgetMB)
+static bool loadSpritesFromCache(
+    std::vector<SpriteList>& sprites,
+    std::unordered_map<SDL_Keycode, size_t>& keymap,
+    const std::vector<fs::path>& files,
+    std::vector<SpriteSource>& sources,
+    const AppContext& ctx,
+    SDL_PixelFormat spriteFormat,
+    SpriteAlignment alignment,
+    bool lazy
+) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    std::vector<char> statOk(files.size(), 0);
+    auto statOne = [&](size_t i) {
+        statOk[i] = statSpriteSource(files[i], sources[i]);
+    };
+    if (ctx.pool) {
+        ctx.pool->run(files.size(), statOne);
+    }
+    else {
+        for (size_t i = 0; i < files.size(); ++i) statOne(i);
+    }
+    if (files.empty() || std::find(statOk.begin(), statOk.end(), 0) != statOk.end()) return false;
+
+    auto cache = std::make_shared<SpriteCache>();
+    if (!cache->open(ctx.cfg.spriteCachePath, static_cast<uint32_t>(spriteFormat),
+                     static_cast<uint32_t>(alignment), sources)) {
+        return false;
+    }
+
+    std::vector<SpriteList> loaded;
+    for (size_t i = 0; i < cache->entries().size(); ++i) {
+        const SpriteCacheEntry& e = cache->entries()[i];
+        SpriteList s;
+        // Сетка - из имени файла, как при декодировании; имя в кэше уже без суффикса
+        parseSpriteGrid(files[i].stem().string(), s.name, s.cols, s.rows);
+        s.sourcePath = sources[i].path;
+        std::copy(std::begin(e.baseOffsetX), std::end(e.baseOffsetX), s.baseOffsetX);
+        std::copy(std::begin(e.baseOffsetY), std::end(e.baseOffsetY), s.baseOffsetY);
+        s.w = e.levels[0].w;
+        s.h = e.levels[0].h;
+        s.pixelStore = cache;
+        s.cacheEntry = static_cast<int>(i);
+        if ((!lazy || i == 0) && !mapCachedSprite(e, spriteFormat, s)) {
+            for (SpriteList& l : loaded) {
+                SDL_DestroySurface(l.surface);
+                for (SDL_Surface* mip : l.mips) SDL_DestroySurface(mip);
+            }
+            return false;
+        }
+        loaded.push_back(std::move(s));
+    }
+
+    for (SpriteList& s : loaded) {
+        size_t idx = sprites.size();
+        SDL_Keycode kc = SDL_GetKeyFromName(s.name.c_str());
+        sprites.push_back(std::move(s));
+        if (kc != SDLK_UNKNOWN) {
+            keymap[kc] = idx;
+        }
+    }
+    std::cout << "Sprites: " << sprites.size() << " mapped from " << ctx.cfg.spriteCachePath << " in "
+              << elapsedMs(start, SDL_GetPerformanceCounter()) << " ms\n";
+    return true;
+}
+
+static bool writeSpriteCache(const std::vector<SpriteList>& sprites, const std::vector<SpriteSource>& sources,
+                             const std::string& path, SDL_PixelFormat spriteFormat, SpriteAlignment alignment) {
+    if (std::any_of(sources.begin(), sources.end(), [](const SpriteSource& s) { return s.path.empty(); })) return false;
+
+    std::vector<SpriteCacheEntry> entries;
+    for (const SpriteList& s : sprites) {
+        SpriteCacheEntry e;
+        e.name = s.name;
+        std::copy(std::begin(s.baseOffsetX), std::end(s.baseOffsetX), e.baseOffsetX);
+        std::copy(std::begin(s.baseOffsetY), std::end(s.baseOffsetY), e.baseOffsetY);
+        e.levels.push_back({ s.surface->pixels, s.surface->w, s.surface->h, s.surface->pitch });
+        for (const SDL_Surface* mip : s.mips) {
+            e.levels.push_back({ mip->pixels, mip->w, mip->h, mip->pitch });
+        }
+        entries.push_back(std::move(e));
+    }
+    if (!SpriteCache::write(path, static_cast<uint32_t>(spriteFormat), static_cast<uint32_t>(alignment), sources, entries)) {
+        std::cerr << "Failed to write sprite cache " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
 void loadSpritesCpu(
     std::vector<SpriteList>& sprites,
     std::unordered_map<SDL_Keycode, size_t>& keymap,
     const std::string& dirPath,
-    AppContext ctx,
+    const AppContext& ctx,
     SpriteAlignment alignment = SpriteAlignment::AsIs
 ) {
     fs::path dir = dirPath.empty() ? fs::current_path() : fs::path(dirPath);
@@ -103,93 +414,218 @@ void loadSpritesCpu(
         fs::create_directory(dir);
     }
 
+    // Без окна (GPU-путь) берём ARGB8888 - родной формат текстур SDL
+    const SDL_PixelFormat spriteFormat = ctx.winSurface ? spriteFormatFor(ctx.winSurface->format) : SDL_PIXELFORMAT_ARGB8888;
+    const int alphaShift = SDL_GetPixelFormatDetails(spriteFormat)->Ashift;
+
+    std::vector<fs::path> files;
     for (const auto& entry : fs::directory_iterator(dir)) {
         if (!entry.is_regular_file()) continue;
         auto ext = entry.path().extension();
         if (ext != ".png" && ext != ".PNG") continue;
+        files.push_back(entry.path());
+    }
 
-        SDL_Surface* surf = IMG_Load(entry.path().string().c_str());
-        if (!surf) {
-            std::cerr << "Failed to load " << entry.path().string() << '\n';
+    // С бюджетом памяти при запуске загружается только первый (текущий) лист,
+    // остальные подгрузит SpriteResidency, когда их выберут
+    const bool lazy = ctx.cfg.spriteBudgetMB > 0;
+    const bool useCache = !ctx.cfg.spriteCachePath.empty();
+    std::vector<SpriteSource> sources(files.size());
+    if (useCache && loadSpritesFromCache(sprites, keymap, files, sources, ctx, spriteFormat, alignment, lazy)) {
+        if (ctx.cfg.useCpuRendering) indexSpritesAlpha(sprites, ctx.pool);
+        return;
+    }
+
+    // Каждый лист декодируется в свой слот, а собираются они по порядку обхода папки,
+    // так что индексы спрайтов и раскладка клавиш не зависят от числа потоков
+    Uint64 start = SDL_GetPerformanceCounter();
+    std::vector<SpriteLoadResult> results(files.size());
+    auto decodeOne = [&](size_t i) {
+        decodeSprite(files[i], spriteFormat, alphaShift, alignment, results[i]);
+    };
+    // Новый кэш пишется из всех листов, поэтому при его пересборке откладывать нечего
+    size_t decodeCount = files.size();
+    if (lazy && !useCache) {
+        decodeCount = 0;
+        while (decodeCount < files.size()) {
+            decodeOne(decodeCount);
+            if (results[decodeCount++].ok) break;
+        }
+        // Отложенный лист: пока только имя, сетка и путь к PNG
+        for (size_t i = decodeCount; i < files.size(); ++i) {
+            SpriteList& s = results[i].sprite;
+            parseSpriteGrid(files[i].stem().string(), s.name, s.cols, s.rows);
+            s.sourcePath = files[i].string();
+            results[i].ok = true;
+        }
+    }
+    else if (ctx.pool) {
+        ctx.pool->run(files.size(), decodeOne);
+    }
+    else {
+        for (size_t i = 0; i < files.size(); ++i) decodeOne(i);
+    }
+    double wallMs = elapsedMs(start, SDL_GetPerformanceCounter());
+
+    double decodeTotal = 0.0, prepareTotal = 0.0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        SpriteLoadResult& r = results[i];
+        decodeTotal += r.decodeMs;
+        prepareTotal += r.prepareMs;
+        if (!r.ok) {
+            std::cerr << r.error << '\n';
             continue;
         }
-
-        SpriteList s;
-        s.surface = surf;
-        s.tex = nullptr;
-        s.w = surf->w;
-        s.h = surf->h;
-        s.name = entry.path().stem().string();
-
-        if (alignment == SpriteAlignment::Centered) {
-            SDL_PixelFormat targetFormat = SDL_PIXELFORMAT_RGBA8888;
-            SDL_Surface* rgbaSurf = SDL_ConvertSurface(surf, targetFormat);
-            if (!rgbaSurf) {
-                std::cerr << "Failed to convert surface to RGBA8888\n";
-            }
-            else {
-                SDL_DestroySurface(surf);
-                surf = rgbaSurf;
-                s.surface = surf;
-                s.w = surf->w;
-                s.h = surf->h;
-            }
-
-            int min_x = surf->w, max_x = -1;
-            int min_y = surf->h, max_y = -1;
-            uint32_t* pixels = static_cast<uint32_t*>(surf->pixels);
-            int pitch = surf->pitch / sizeof(uint32_t);
-
-            int quadW = surf->w / 2;
-            int quadH = surf->h / 2;
-
-            for (int fy = 0; fy < 2; ++fy) {
-                for (int fx = 0; fx < 2; ++fx) {
-                    int idx = fy * 2 + fx;
-
-                    int min_x = quadW, max_x = -1;
-                    int min_y = quadH, max_y = -1;
-
-                    for (int y = 0; y < quadH; ++y) {
-                        for (int x = 0; x < quadW; ++x) {
-                            int gx = fx * quadW + x;
-                            int gy = fy * quadH + y;
-                            uint32_t pixel = pixels[gy * pitch + gx];
-                            uint8_t alpha = (pixel >> 24) & 0xFF;
-                            if (alpha > 0) {
-                                if (x < min_x) min_x = x;
-                                if (x > max_x) max_x = x;
-                                if (y < min_y) min_y = y;
-                                if (y > max_y) max_y = y;
-                            }
-                        }
-                    }
-
-                    if (min_x <= max_x && min_y <= max_y) {
-                        float current_center_x = (min_x + max_x) * 0.5f;
-                        float current_center_y = (min_y + max_y) * 0.5f;
-                        float quad_center_x = quadW * 0.5f;
-                        float quad_center_y = quadH * 0.5f;
-
-                        s.baseOffsetX[idx] = quad_center_x - current_center_x;
-                        s.baseOffsetY[idx] = quad_center_y - current_center_y;
-                    }
-                }
-            }
+        if (i < decodeCount) {
+            std::cout << "  " << files[i].filename().string() << ": decode " << r.decodeMs
+                      << " ms, prepare " << r.prepareMs << " ms\n";
         }
 
         size_t idx = sprites.size();
-        sprites.push_back(s);
+        sprites.push_back(r.sprite);
 
-        SDL_Keycode kc = SDL_GetKeyFromName(s.name.c_str());
+        SDL_Keycode kc = SDL_GetKeyFromName(r.sprite.name.c_str());
         if (kc != SDLK_UNKNOWN) {
             keymap[kc] = idx;
         }
     }
+    std::cout << "Sprites: " << sprites.size() << "/" << files.size() << " loaded in " << wallMs
+              << " ms (decode " << decodeTotal << " ms, prepare " << prepareTotal << " ms summed over "
+              << (ctx.pool ? ctx.pool->size() : 1) << " threads)";
+    if (decodeCount < files.size()) std::cout << ", " << files.size() - decodeCount << " deferred";
+    std::cout << '\n';
+
+    // Кэш пишется, только если загрузились все листы - иначе в следующий раз снова попробуем PNG
+    if (useCache && !sprites.empty() && sprites.size() == files.size()) {
+        // Хэши нужны только новому кэшу: проверка при запуске обходится размером и временем
+        auto hashOne = [&](size_t i) {
+            if (!hashFile(files[i], sources[i].hash)) sources[i].path.clear();
+        };
+        if (ctx.pool) {
+            ctx.pool->run(files.size(), hashOne);
+        }
+        else {
+            for (size_t i = 0; i < files.size(); ++i) hashOne(i);
+        }
+        if (writeSpriteCache(sprites, sources, ctx.cfg.spriteCachePath, spriteFormat, alignment) && lazy) {
+            // Декодированные листы больше не нужны: текущий берётся из только что записанного кэша,
+            // остальные подгрузятся из него же по мере выбора
+            std::vector<SpriteList> mapped;
+            std::unordered_map<SDL_Keycode, size_t> mappedKeys;
+            if (loadSpritesFromCache(mapped, mappedKeys, files, sources, ctx, spriteFormat, alignment, true)) {
+                for (SpriteList& s : sprites) {
+                    SDL_DestroySurface(s.surface);
+                    for (SDL_Surface* mip : s.mips) SDL_DestroySurface(mip);
+                }
+                sprites.swap(mapped);
+                keymap.swap(mappedKeys);
+            }
+        }
+    }
 
     if (sprites.empty()) {
         std::cerr << "No sprites found.\n";
     }
+    if (ctx.cfg.useCpuRendering) indexSpritesAlpha(sprites, ctx.pool);
+}
+
+// Переносит лист и его мипы на видеокарту; поверхности после этого освобождаются
+static bool uploadSpriteTextures(SDL_Renderer* renderer, SpriteList& s) {
+    SDL_Texture* tex = SDL_CreateTextureFromSurface(renderer, s.surface);
+    SDL_DestroySurface(s.surface);
+    s.surface = nullptr;
+    s.tex = tex;
+    // Уровни идут подряд: если один не создался, дальше цепочку не продолжаем
+    bool chainOk = tex != nullptr;
+    for (SDL_Surface* mip : s.mips) {
+        SDL_Texture* mipTex = chainOk ? SDL_CreateTextureFromSurface(renderer, mip) : nullptr;
+        SDL_DestroySurface(mip);
+        chainOk = mipTex != nullptr;
+        if (!chainOk) continue;
+        SDL_SetTextureBlendMode(mipTex, SDL_BLENDMODE_BLEND_PREMULTIPLIED);
+        s.mipTextures.push_back(mipTex);
+    }
+    s.mips.clear();
+    // Пиксели уже на видеокарте. Отображение кэша остаётся, чтобы выгруженный лист залить заново без PNG
+    if (s.cacheEntry >= 0) releaseCachedPages(s);
+    else s.pixelStore.reset();
+    if (!tex) return false;
+    SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND_PREMULTIPLIED);
+    return true;
+}
+
+/**
+ * @brief buildSpriteAtlas Укладывает непрозрачные части кадров всех листов и всех мипов в общие текстуры
+ * @return false - атлас не собрался (кадр больше страницы, нет памяти); листы остаются нетронутыми
+ *
+ * Кадр обрезается по альфе с запасом в пиксель, чтобы билинейка на краю видела прозрачный ноль.
+ * При успехе поверхности листов освобождаются: рисуется только из страниц атласа.
+ */
+static bool buildSpriteAtlas(SDL_Renderer* renderer, std::vector<SpriteList>& sprites, std::vector<SDL_Texture*>& pages) {
+    int pageSize = 4096;
+    const Sint64 maxSize = SDL_GetNumberProperty(SDL_GetRendererProperties(renderer),
+                                                 SDL_PROP_RENDERER_MAX_TEXTURE_SIZE_NUMBER, 0);
+    if (maxSize > 0) pageSize = static_cast<int>(std::min<Sint64>(pageSize, maxSize));
+
+    const int alphaShift = SDL_GetPixelFormatDetails(SDL_PIXELFORMAT_ARGB8888)->Ashift;
+    std::vector<AtlasItem> items;
+    size_t sheetBytes = 0;
+    for (SpriteList& s : sprites) {
+        if (!s.surface || s.surface->format != SDL_PIXELFORMAT_ARGB8888) return false;
+        std::vector<SDL_Surface*> levels{ s.surface };
+        levels.insert(levels.end(), s.mips.begin(), s.mips.end());
+        const int frames = s.cols * s.rows;
+        s.atlasFrames.assign(levels.size(), std::vector<AtlasFrame>(frames));
+        for (size_t level = 0; level < levels.size(); ++level) {
+            const SDL_Surface* surf = levels[level];
+            sheetBytes += static_cast<size_t>(surf->w) * surf->h * 4;
+            const int quadW = surf->w / s.cols, quadH = surf->h / s.rows;
+            const int pitch = surf->pitch / 4;
+            for (int idx = 0; idx < frames; ++idx) {
+                const int qx = (idx % s.cols) * quadW, qy = (idx / s.cols) * quadH;
+                const Uint32* quad = static_cast<const Uint32*>(surf->pixels) + qy * pitch + qx;
+                AlphaBounds b = findAlphaBounds(quad, pitch, quadW, quadH, alphaShift);
+                if (b.empty()) continue;
+                const int x0 = std::max(0, b.minX - 1), y0 = std::max(0, b.minY - 1);
+                const int x1 = std::min(quadW - 1, b.maxX + 1), y1 = std::min(quadH - 1, b.maxY + 1);
+                AtlasFrame& frame = s.atlasFrames[level][idx];
+                frame.crop = { x0, y0, x1 - x0 + 1, y1 - y0 + 1 };
+                items.push_back({ surf, { qx + x0, qy + y0, frame.crop.w, frame.crop.h }, &frame });
+            }
+        }
+    }
+
+    std::vector<SDL_Surface*> surfaces = packAtlas(items, pageSize, SDL_PIXELFORMAT_ARGB8888);
+    bool ok = !surfaces.empty() || items.empty();
+    size_t atlasBytes = 0;
+    for (SDL_Surface* surf : surfaces) {
+        SDL_Texture* tex = ok ? SDL_CreateTextureFromSurface(renderer, surf) : nullptr;
+        atlasBytes += static_cast<size_t>(surf->w) * surf->h * 4;
+        SDL_DestroySurface(surf);
+        if (!tex) {
+            ok = false;
+            continue;
+        }
+        SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND_PREMULTIPLIED);
+        pages.push_back(tex);
+    }
+    if (!ok) {
+        for (SDL_Texture* tex : pages) SDL_DestroyTexture(tex);
+        pages.clear();
+        for (SpriteList& s : sprites) s.atlasFrames.clear();
+        return false;
+    }
+
+    for (SpriteList& s : sprites) {
+        SDL_DestroySurface(s.surface);
+        for (SDL_Surface* mip : s.mips) SDL_DestroySurface(mip);
+        s.surface = nullptr;
+        s.mips.clear();
+        s.pixelStore.reset();
+    }
+    std::cout << "Sprite atlas: " << pages.size() << " pages, " << atlasBytes / (1024.0 * 1024.0)
+              << " MB instead of " << sheetBytes / (1024.0 * 1024.0) << " MB\n";
+    return true;
 }
 
 static void loadSprites(
@@ -197,30 +633,448 @@ static void loadSprites(
     const std::string& dirPath,
     std::vector<SpriteList>& sprites,
     std::unordered_map<SDL_Keycode, size_t>& keymap,
-    SpriteAlignment alignment = SpriteAlignment::AsIs
+    SpriteAlignment alignment = SpriteAlignment::AsIs,
+    ThreadPool* pool = nullptr,
+    const std::string& cachePath = "",
+    std::vector<SDL_Texture*>* atlasPages = nullptr,
+    int budgetMB = 0
 ) {
     std::vector<SpriteList> cpuSprites;
     std::unordered_map<SDL_Keycode, size_t> cpuKeymap;
     AppContext dummyCtx{ nullptr, renderer };
+    dummyCtx.pool = pool;
+    dummyCtx.cfg.spriteCachePath = cachePath;
+    dummyCtx.cfg.spriteBudgetMB = atlasPages ? 0 : budgetMB; // атлас собирается из всех листов сразу
     loadSpritesCpu(cpuSprites, cpuKeymap, dirPath, dummyCtx, alignment);
 
-    for (auto& s : cpuSprites) {
-        if (s.surface) {
-            SDL_Texture* tex = SDL_CreateTextureFromSurface(renderer, s.surface);
-            SDL_DestroySurface(s.surface);
-            s.surface = nullptr;
-            s.tex = tex;
-            if (tex) {
+    if (atlasPages) {
+        cpuSprites.erase(std::remove_if(cpuSprites.begin(), cpuSprites.end(),
+                                        [](const SpriteList& s) { return !s.surface; }),
+                         cpuSprites.end());
+        if (buildSpriteAtlas(renderer, cpuSprites, *atlasPages)) {
+            for (auto& s : cpuSprites) {
                 sprites.push_back(s);
                 if (cpuKeymap.count(SDL_GetKeyFromName(s.name.c_str()))) {
                     keymap[SDL_GetKeyFromName(s.name.c_str())] = sprites.size() - 1;
                 }
             }
-            std::cout << s.baseOffsetX << " " << s.baseOffsetY << std::endl;
+            return;
+        }
+        std::cerr << "Sprite atlas failed, using separate textures\n";
+    }
+
+    for (auto& s : cpuSprites) {
+        // Лист без поверхности отложен (budgetMB) и попадёт на видеокарту при подгрузке
+        const bool deferred = !s.surface;
+        if (deferred || uploadSpriteTextures(renderer, s)) {
+            sprites.push_back(s);
+            if (cpuKeymap.count(SDL_GetKeyFromName(s.name.c_str()))) {
+                keymap[SDL_GetKeyFromName(s.name.c_str())] = sprites.size() - 1;
+            }
+        }
+        if (!deferred) std::cout << s.baseOffsetX << " " << s.baseOffsetY << std::endl;
+    }
+}
+
+
+// Сколько памяти занимает лист со всеми мипами (для текстур - столько же видеопамяти)
+static size_t spriteBytes(const SpriteList& s) {
+    size_t bytes = 0;
+    if (s.surface) {
+        bytes += static_cast<size_t>(s.surface->pitch) * s.surface->h;
+        for (const SDL_Surface* mip : s.mips) bytes += static_cast<size_t>(mip->pitch) * mip->h;
+        for (const AlphaSpanIndex& spans : s.alphaSpans) bytes += spans.bytes();
+    }
+    else if (s.tex) {
+        int w = s.w, h = s.h;
+        bytes += static_cast<size_t>(w) * h * 4;
+        for (size_t i = 0; i < s.mipTextures.size(); ++i) {
+            w /= 2;
+            h /= 2;
+            bytes += static_cast<size_t>(w) * h * 4;
+        }
+    }
+    return bytes;
+}
+
+static void releaseSpritePixels(SpriteList& s) {
+    if (s.tex) SDL_DestroyTexture(s.tex);
+    for (SDL_Texture* mipTex : s.mipTextures) SDL_DestroyTexture(mipTex);
+    if (s.surface) SDL_DestroySurface(s.surface);
+    for (SDL_Surface* mip : s.mips) SDL_DestroySurface(mip);
+    s.tex = nullptr;
+    s.surface = nullptr;
+    s.mipTextures.clear();
+    s.mips.clear();
+    s.alphaSpans.clear();
+    s.pixelStore.reset();
+}
+
+// Выгрузка по бюджету: лист из кэша сохраняет отображение, но его страницы отдаются ОС
+static void evictSpritePixels(SpriteList& s) {
+    std::shared_ptr<void> cache = s.cacheEntry >= 0 ? s.pixelStore : nullptr;
+    releaseSpritePixels(s);
+    s.pixelStore = std::move(cache);
+    releaseCachedPages(s);
+}
+
+// Можно звать из любого потока: очередь событий SDL потокобезопасна
+static void wakeMainLoop(const AppContext& ctx) {
+    if (ctx.state->wakeEvent == 0) return;
+    SDL_Event ev{};
+    ev.type = ctx.state->wakeEvent;
+    SDL_PushEvent(&ev);
+}
+
+// Лист декодируется в фоновом потоке резидентности, а ставится на место в главном
+static void requestSpriteLoad(AppContext& ctx, size_t index) {
+    SpriteResidency& res = *ctx.residency;
+    if (res.isResident(index) || res.isLoading(index)) return;
+
+    const SDL_PixelFormat spriteFormat = ctx.cfg.useCpuRendering && ctx.winSurface
+        ? spriteFormatFor(ctx.winSurface->format) : SDL_PIXELFORMAT_ARGB8888;
+    const int alphaShift = SDL_GetPixelFormatDetails(spriteFormat)->Ashift;
+    const SpriteList& sheet = ctx.sprites[index];
+    fs::path path = sheet.sourcePath;
+    // Лист из кэша заново отображается из файла, остальные декодируются из PNG
+    std::shared_ptr<SpriteCache> cache = sheet.cacheEntry >= 0 && sheet.pixelStore
+        ? std::static_pointer_cast<SpriteCache>(sheet.pixelStore) : nullptr;
+    const int cacheEntry = sheet.cacheEntry;
+    SpriteAlignment alignment = ctx.cfg.alignment;
+    const bool cpu = ctx.cfg.useCpuRendering;
+    const uint64_t generation = res.generation(index);
+    AppContext* app = &ctx;
+
+    res.load(index, [=]() -> SpriteResidency::Finish {
+        // Поверхности, которые завершение не забрало (выход до poll(), устаревший результат), освобождает сам результат
+        std::shared_ptr<SpriteLoadResult> result(new SpriteLoadResult, [](SpriteLoadResult* r) {
+            releaseSpritePixels(r->sprite);
+            delete r;
+        });
+        if (cache) {
+            const SpriteCacheEntry& e = cache->entries()[cacheEntry];
+            SpriteList& s = result->sprite;
+            std::copy(std::begin(e.baseOffsetX), std::end(e.baseOffsetX), s.baseOffsetX);
+            std::copy(std::begin(e.baseOffsetY), std::end(e.baseOffsetY), s.baseOffsetY);
+            result->ok = mapCachedSprite(e, spriteFormat, s);
+            if (result->ok) {
+                s.w = s.surface->w;
+                s.h = s.surface->h;
+            }
+            else {
+                result->error = "Failed to map " + path.string() + " from the sprite cache: " + SDL_GetError();
+            }
+        }
+        else {
+            decodeSprite(path, spriteFormat, alphaShift, alignment, *result);
         }
+        if (cpu && result->ok) indexSpriteAlpha(result->sprite);
+        return [app, index, generation, result]() {
+            AppContext& ctx = *app;
+            MainLoopState& st = *ctx.state;
+            SpriteList& sp = ctx.sprites[index];
+            // Пока лист грузился, горячая перезагрузка его заменила или удалила - результат устарел
+            if (ctx.residency->generation(index) != generation) {
+                if (st.pendingSpriteIndex == static_cast<int>(index)) {
+                    if (ctx.residency->isResident(index)) st.currentSpriteIndex = static_cast<int>(index);
+                    st.pendingSpriteIndex = -1;
+                }
+                return;
+            }
+            bool ok = result->ok;
+            if (ok) {
+                sp.surface = result->sprite.surface;
+                sp.mips = result->sprite.mips;
+                sp.alphaSpans = std::move(result->sprite.alphaSpans);
+                result->sprite.surface = nullptr; // теперь ими владеет лист
+                result->sprite.mips.clear();
+                // Отложенный при запуске лист знает только имя и сетку
+                sp.w = result->sprite.w;
+                sp.h = result->sprite.h;
+                std::copy(std::begin(result->sprite.baseOffsetX), std::end(result->sprite.baseOffsetX), sp.baseOffsetX);
+                std::copy(std::begin(result->sprite.baseOffsetY), std::end(result->sprite.baseOffsetY), sp.baseOffsetY);
+                if (!ctx.cfg.useCpuRendering) ok = uploadSpriteTextures(ctx.ren, sp);
+            }
+            if (!ok) {
+                std::cerr << (result->error.empty() ? "Failed to reload " + sp.sourcePath : result->error) << '\n';
+                evictSpritePixels(sp);
+                ctx.residency->markEvicted(index);
+                if (st.pendingSpriteIndex == static_cast<int>(index)) st.pendingSpriteIndex = -1;
+                return;
+            }
+            ctx.residency->markResident(index, spriteBytes(sp));
+            if (st.pendingSpriteIndex == static_cast<int>(index)) {
+                st.currentSpriteIndex = static_cast<int>(index);
+                st.pendingSpriteIndex = -1;
+            }
+        };
+    });
+}
+
+// Переключение по клавише: выгруженный лист сначала подгружается, а недавно выбранные
+// подтягиваются заранее, чтобы следующее переключение было мгновенным
+static void selectSprite(AppContext& ctx, int index) {
+    MainLoopState& st = *ctx.state;
+    auto& recent = st.recentSprites;
+    recent.erase(std::remove(recent.begin(), recent.end(), index), recent.end());
+    recent.insert(recent.begin(), index);
+    if (recent.size() > ctx.sprites.size()) recent.resize(ctx.sprites.size());
+
+    if (!ctx.residency || ctx.residency->isResident(index)) {
+        st.currentSpriteIndex = index;
+        st.pendingSpriteIndex = -1;
+    }
+    else {
+        st.pendingSpriteIndex = index;
+        requestSpriteLoad(ctx, index);
+    }
+
+    if (!ctx.residency) return;
+    const size_t prefetch = std::min(recent.size(), static_cast<size_t>(std::max(0, ctx.cfg.spritePrefetch)));
+    for (size_t i = 0; i < prefetch; ++i) {
+        requestSpriteLoad(ctx, recent[i]);
+    }
+}
+
+// Раз за итерацию цикла: ставит подгруженные листы и выгружает давно не нужные сверх бюджета
+static void updateSpriteResidency(AppContext& ctx) {
+    if (!ctx.residency) return;
+    MainLoopState& st = *ctx.state;
+    SpriteResidency& res = *ctx.residency;
+
+    res.poll();
+    res.touch(st.currentSpriteIndex);
+
+    std::vector<size_t> pinned{ static_cast<size_t>(st.currentSpriteIndex) };
+    if (st.pendingSpriteIndex >= 0) pinned.push_back(st.pendingSpriteIndex);
+    const size_t prefetch = std::min(st.recentSprites.size(), static_cast<size_t>(std::max(0, ctx.cfg.spritePrefetch)));
+    for (size_t i = 0; i < prefetch; ++i) pinned.push_back(st.recentSprites[i]);
+
+    for (size_t victim : res.overBudget(pinned)) {
+        evictSpritePixels(ctx.sprites[victim]);
+        res.markEvicted(victim);
+    }
+}
+
+static void initSpriteResidency(AppContext& ctx) {
+    // Атлас общий для всех листов - выгружать по одному нечего
+    if (ctx.cfg.spriteBudgetMB <= 0 || ctx.sprites.empty() || !ctx.atlasPages.empty()) return;
+    // Готовый лист будит цикл: без этого спящий цикл поставил бы его только к следующему событию
+    AppContext* app = &ctx;
+    ctx.residency = new SpriteResidency(static_cast<size_t>(ctx.cfg.spriteBudgetMB) << 20, ctx.sprites.size(),
+                                        [app]() { wakeMainLoop(*app); });
+    for (size_t i = 0; i < ctx.sprites.size(); ++i) {
+        const SpriteList& s = ctx.sprites[i];
+        if (s.surface || s.tex) ctx.residency->markResident(i, spriteBytes(s));
+        else ctx.residency->markEvicted(i); // отложен при загрузке (loadSpritesCpu)
     }
+    // Если листы всё же загружены все (атлас не собрался), сразу урезаем до бюджета, оставляя первый
+    updateSpriteResidency(ctx);
+    std::cout << "Sprite budget: " << ctx.cfg.spriteBudgetMB << " MB, resident "
+              << ctx.residency->bytes() / (1024.0 * 1024.0) << " MB\n";
 }
 
+// Листы и кэши кадров трогает только рендер; остальные потоки ставят правки в очередь
+static void postRenderJob(AppContext& ctx, std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lk(ctx.state->renderJobsMutex);
+        ctx.state->renderJobs.push_back(std::move(job));
+    }
+    wakeMainLoop(ctx);
+}
+
+static void runRenderJobs(AppContext& ctx) {
+    std::vector<std::function<void()>> jobs;
+    {
+        std::lock_guard<std::mutex> lk(ctx.state->renderJobsMutex);
+        jobs.swap(ctx.state->renderJobs);
+    }
+    for (auto& job : jobs) job();
+}
+
+// Готовые кадры ссылаются на индексы листов - после замены листа их нельзя отдавать
+static void invalidateRenderedFrames(AppContext& ctx) {
+    if (ctx.cpuFrameCache) ctx.cpuFrameCache->clear();
+    ctx.state->cpuFullRedraw = true;
+    ctx.state->prevFrameIndex = -1;
+}
+
+// Ставит перечитанный лист на место старого (или добавляет новый) - вызывается между кадрами
+static void installReloadedSprite(AppContext& ctx, SpriteList sprite) {
+    if (!ctx.cfg.useCpuRendering && !uploadSpriteTextures(ctx.ren, sprite)) {
+        std::cerr << "Hot reload: failed to upload " << sprite.sourcePath << '\n';
+        releaseSpritePixels(sprite);
+        return;
+    }
+
+    size_t index = ctx.sprites.size();
+    for (size_t i = 0; i < ctx.sprites.size(); ++i) {
+        if (ctx.sprites[i].name == sprite.name) index = i;
+    }
+    if (index < ctx.sprites.size()) {
+        // Старые кадры в атласе остаются неиспользованными до перезапуска, новый лист - в своих текстурах
+        releaseSpritePixels(ctx.sprites[index]);
+        ctx.sprites[index] = std::move(sprite);
+        if (ctx.residency) ctx.residency->markResident(index, spriteBytes(ctx.sprites[index]));
+    }
+    else {
+        ctx.sprites.push_back(std::move(sprite));
+        if (ctx.residency) ctx.residency->add(spriteBytes(ctx.sprites[index]));
+    }
+
+    SDL_Keycode kc = SDL_GetKeyFromName(ctx.sprites[index].name.c_str());
+    if (kc != SDLK_UNKNOWN) ctx.keymap[kc] = index;
+    invalidateRenderedFrames(ctx);
+    std::cout << "Hot reload: " << ctx.sprites[index].sourcePath << '\n';
+}
+
+// Индекс удалённого листа не переиспользуется другими: он остаётся пустым и без клавиши,
+// а если файл вернётся - займёт своё прежнее место
+static void removeReloadedSprite(AppContext& ctx, const std::string& name) {
+    MainLoopState& st = *ctx.state;
+    size_t index = ctx.sprites.size();
+    size_t fallback = ctx.sprites.size();
+    for (size_t i = 0; i < ctx.sprites.size(); ++i) {
+        if (ctx.sprites[i].sourcePath.empty()) continue;
+        if (ctx.sprites[i].name == name) index = i;
+        else if (fallback == ctx.sprites.size()) fallback = i;
+    }
+    if (index == ctx.sprites.size()) return;
+    if (fallback == ctx.sprites.size()) {
+        std::cout << "Hot reload: " << name << " removed, keeping the last sprite on screen\n";
+        return;
+    }
+
+    for (auto it = ctx.keymap.begin(); it != ctx.keymap.end();) {
+        if (it->second == index) it = ctx.keymap.erase(it);
+        else ++it;
+    }
+    auto& recent = st.recentSprites;
+    recent.erase(std::remove(recent.begin(), recent.end(), static_cast<int>(index)), recent.end());
+    if (st.pendingSpriteIndex == static_cast<int>(index)) st.pendingSpriteIndex = -1;
+    if (st.currentSpriteIndex == static_cast<int>(index)) selectSprite(ctx, static_cast<int>(fallback));
+
+    SpriteList& sp = ctx.sprites[index];
+    releaseSpritePixels(sp);
+    sp.atlasFrames.clear();
+    sp.sourcePath.clear();
+    sp.cacheEntry = -1;
+    if (ctx.residency) ctx.residency->markEvicted(index);
+    invalidateRenderedFrames(ctx);
+    std::cout << "Hot reload: " << name << " removed\n";
+}
+
+// vsync: Present ждёт обратного хода луча, пустые кадры по-прежнему отмеряет FramePacer
+static void applyVsync(AppContext& ctx) {
+    const int interval = ctx.cfg.vsync ? 1 : 0;
+    bool ok = true;
+    if (ctx.ren) ok = SDL_SetRenderVSync(ctx.ren, interval);
+    else if (ctx.win && ctx.winSurface) ok = SDL_SetWindowSurfaceVSync(ctx.win, interval);
+    else ok = !ctx.cfg.vsync; // headless: показывать некуда
+    if (!ok && ctx.cfg.vsync) std::cerr << "VSync is not available: " << SDL_GetError() << '\n';
+    ctx.state->pacer.setVsync(ctx.cfg.vsync && ok);
+}
+
+// Из config.ini на лету берутся только настройки, которые не требуют пересоздавать окно или листы
+static void applyReloadedConfig(AppContext& ctx, const AppConfig& cfg) {
+    AppConfig& cur = ctx.cfg;
+    cur.debugMode = cfg.debugMode;
+    cur.bgColor = cfg.bgColor;
+    cur.micThreshold = cfg.micThreshold;
+    cur.micGain = cfg.micGain;
+    cur.micHysteresis = cfg.micHysteresis;
+    cur.micAttackMs = cfg.micAttackMs;
+    cur.micReleaseMs = cfg.micReleaseMs;
+    cur.micAutoCalibrate = cfg.micAutoCalibrate;
+    cur.visemes = cfg.visemes;
+    if (ctx.audio) {
+        ctx.audio->configure(vadParamsFrom(cur));
+        ctx.audio->setVisemes(cur.visemes);
+    }
+    cur.enableBreathing = cfg.enableBreathing;
+    cur.breathingAmp = cfg.breathingAmp;
+    cur.breathingFreq = cfg.breathingFreq;
+    cur.enableShaking = cfg.enableShaking;
+    cur.shakingAmp = cfg.shakingAmp;
+    cur.shakingFreq = cfg.shakingFreq;
+    cur.fps = std::max(1, cfg.fps);
+    if (cur.vsync != cfg.vsync) {
+        cur.vsync = cfg.vsync;
+        applyVsync(ctx);
+    }
+    cur.cpuFilter = cfg.cpuFilter;
+    cur.stageLogPath = cfg.stageLogPath;
+    const int prefetch = cfg.spritePrefetch;
+    postRenderJob(ctx, [&ctx, prefetch]() {
+        ctx.cfg.spritePrefetch = prefetch;
+        invalidateRenderedFrames(ctx);
+    });
+    std::cout << "Hot reload: config.ini applied (window, renderer and sprite settings need a restart)\n";
+}
+
+/**
+ * @brief initHotReload Следит за папкой спрайтов и config.ini
+ *
+ * Изменённый PNG декодируется в потоке наблюдателя, на видеокарту и в списки
+ * листов он попадает в главном потоке между кадрами (FileWatcher::poll в цикле).
+ */
+static void initHotReload(AppContext& ctx, const fs::path& configDir) {
+    if (!ctx.cfg.hotReload) return;
+    const fs::path spriteDir = ctx.cfg.spriteDir.empty() ? fs::current_path() : fs::path(ctx.cfg.spriteDir);
+    const fs::path configPath = configDir / "config.ini";
+    const SDL_PixelFormat spriteFormat = ctx.cfg.useCpuRendering && ctx.winSurface
+        ? spriteFormatFor(ctx.winSurface->format) : SDL_PIXELFORMAT_ARGB8888;
+    const int alphaShift = SDL_GetPixelFormatDetails(spriteFormat)->Ashift;
+    const SpriteAlignment alignment = ctx.cfg.alignment;
+    const bool cpu = ctx.cfg.useCpuRendering;
+    AppContext* app = &ctx;
+
+    std::error_code sameDir;
+    std::vector<std::string> dirs{ spriteDir.string() };
+    if (!fs::equivalent(spriteDir, configDir, sameDir)) dirs.push_back(configDir.string());
+
+    ctx.watcher = new FileWatcher(dirs, [=](const FileWatcher::Change& change) -> FileWatcher::Finish {
+        const fs::path path(change.path);
+        std::error_code ec;
+        if (path.filename() == "config.ini" && fs::equivalent(path.parent_path(), configDir, ec)) {
+            if (change.removed) return nullptr;
+            try {
+                AppConfig cfg = loadConfig(configDir);
+                return [app, cfg]() { applyReloadedConfig(*app, cfg); };
+            }
+            catch (const std::exception& e) {
+                // Файл могли сохранить на середине правки - ждём следующего сохранения
+                std::cerr << "Hot reload: config.ini not applied: " << e.what() << '\n';
+                return nullptr;
+            }
+        }
+        if (!fs::equivalent(path.parent_path(), spriteDir, ec)) return nullptr;
+        if (path.extension() != ".png" && path.extension() != ".PNG") return nullptr;
+
+        if (change.removed) {
+            std::string name;
+            int cols, rows;
+            parseSpriteGrid(path.stem().string(), name, cols, rows);
+            return [app, name]() { postRenderJob(*app, [app, name]() { removeReloadedSprite(*app, name); }); };
+        }
+        auto result = std::make_shared<SpriteLoadResult>();
+        decodeSprite(path, spriteFormat, alphaShift, alignment, *result);
+        if (cpu && result->ok) indexSpriteAlpha(result->sprite);
+        if (!result->ok) {
+            std::cerr << result->error << '\n';
+            return nullptr;
+        }
+        return [app, result]() {
+            postRenderJob(*app, [app, result]() { installReloadedSprite(*app, std::move(result->sprite)); });
+        };
+    }, [app]() { wakeMainLoop(*app); });
+    if (!ctx.watcher->active()) {
+        delete ctx.watcher;
+        ctx.watcher = nullptr;
+        return;
+    }
+    std::cout << "Hot reload: watching " << spriteDir.string() << '\n';
+}
 
 static void initializeMainLoopState(AppContext &ctx) {
     ctx.state->perfStart = SDL_GetPerformanceCounter();
@@ -228,23 +1082,41 @@ static void initializeMainLoopState(AppContext &ctx) {
     ctx.state->lastBlink = SDL_GetTicks();
 }
 
-static void handleEvents(AppContext& ctx) {
+// waitMs > 0 - цикл простаивает: первое событие ждём до waitMs, остальные забираем без ожидания
+static void handleEvents(AppContext& ctx, int waitMs = 0) {
     SDL_Event ev;
-    while (SDL_PollEvent(&ev)) {
+    bool waited = waitMs > 0 && SDL_WaitEventTimeout(&ev, waitMs);
+    while (waited || SDL_PollEvent(&ev)) {
+        waited = false;
         switch (ev.type) {
         case SDL_EVENT_QUIT:
             ctx.state->running = false;
             break;
 
+        case SDL_EVENT_WINDOW_RESIZED:
+        case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+            // Старая поверхность окна после изменения размера недействительна
+            if (ctx.cfg.useCpuRendering) ctx.winSurface = nullptr;
+            ctx.state->cpuFullRedraw = true;
+            break;
+
+        case SDL_EVENT_WINDOW_EXPOSED:
+            ctx.state->cpuFullRedraw = true;
+            break;
+
         case SDL_EVENT_KEY_DOWN: {
             if (ev.key.key == SDLK_ESCAPE) {
                 ctx.state->running = false;
             }
             else {
-                auto it = ctx.keymap.find(ev.key.key);
-                if (it != ctx.keymap.end()) {
-                    ctx.state->currentSpriteIndex = static_cast<int>(it->second);
-                }
+                // Раскладку, листы и их подгрузку трогает только рендер, а без окна он в своём потоке
+                const SDL_Keycode key = ev.key.key;
+                postRenderJob(ctx, [&ctx, key]() {
+                    auto it = ctx.keymap.find(key);
+                    if (it != ctx.keymap.end()) {
+                        selectSprite(ctx, static_cast<int>(it->second));
+                    }
+                });
             }
             break;
         }
@@ -388,24 +1260,18 @@ static void updateAudioState(AppContext& ctx) {
     ctx.state->prevSpeak = ctx.state->speak;
     ctx.state->speak = false;
 
-    if (!ctx.stream) return;
-
-    int avail = SDL_GetAudioStreamAvailable(ctx.stream);
-    if (avail <= 0) return;
-
-    int toRead = std::min(avail, 4096);
-    std::vector<float> buffer(toRead / sizeof(float));
-    int got = SDL_GetAudioStreamData(ctx.stream, buffer.data(), toRead);
-    if (got <= 0) return;
+    // Решение принимает детектор в потоке анализа, здесь только снимок
+    if (ctx.audio) {
+        ctx.state->speak = ctx.audio->speaking();
+        ctx.state->viseme = ctx.audio->viseme();
+    }
 
-    int samples = got / sizeof(float);
-    double sum = 0.0;
-    for (int i = 0; i < samples; ++i) {
-        double v = buffer[i] * 2.0 * (1.0f + ctx.cfg.micGain);
-        sum += v * v;
+    // Рот открылся - запоминаем, когда был захвачен звук; закрылся раньше показа - мерить нечего.
+    // Записывает задержку рендер, когда покажет кадр с этим снимком
+    if (ctx.latency) {
+        if (ctx.state->speak && !ctx.state->prevSpeak) ctx.state->speakOnsetNs = ctx.audio->onsetNs();
+        else if (!ctx.state->speak) ctx.state->speakOnsetNs = 0;
     }
-    double rms = std::sqrt(sum / samples);
-    ctx.state->speak = (rms > ctx.cfg.micThreshold);
 }
 
 // todo: Доделать дыхание (чтобы был разговор на выдохе)
@@ -443,9 +1309,10 @@ static void updateBreathing(const AppContext& ctx) {
     ctx.state->breathScale = ctx.state->isBreathing ? (1.0f + 0.03f * std::sin(ctx.state->breathPhase)) : 1.0f;
 }
 
+constexpr Uint32 BLINK_INTERVAL = 3000;
+constexpr Uint32 BLINK_DURATION = 200;
+
 static void updateBlinking(AppContext &ctx) {
-    const Uint32 BLINK_INTERVAL = 3000;
-    const Uint32 BLINK_DURATION = 200;
     Uint32 nowMs = SDL_GetTicks();
 
     if (!ctx.state->blink && nowMs - ctx.state->lastBlink >= BLINK_INTERVAL) {
@@ -458,60 +1325,188 @@ static void updateBlinking(AppContext &ctx) {
     }
 }
 
-static void renderFrame(AppContext& ctx, int frameIndex) {
+// Раз в секунду: сводки этапов за окно для текста поверх кадра и, если задан stageLog, в файл
+static void collectStageTimings(AppContext& ctx) {
+    MainLoopState& st = *ctx.state;
+    const Uint64 now = SDL_GetTicks();
+    if (st.stageWindowStart == 0) st.stageWindowStart = now;
+    if (now - st.stageWindowStart < 1000) return;
+    st.stageWindowStart = now;
+    st.stages.collect(st.stageSummary);
+    ++st.stageWindow;
+    if (ctx.cfg.stageLogPath.empty()) return;
+    // Файл пишет свой поток: открытие и ротация не должны задерживать кадр
+    if (!ctx.stageLog) ctx.stageLog = new StageLogWriter();
+    ctx.stageLog->push(ctx.cfg.stageLogPath, st.stageSummary, now);
+}
+
+static void publishRenderSnapshot(AppContext& ctx) {
+    const MainLoopState& st = *ctx.state;
+    RenderSnapshot& snap = ctx.state->snapshots.back();
+    snap.globalTime = st.globalTime;
+    snap.offsetX = st.offsetX;
+    snap.offsetY = st.offsetY;
+    snap.scale = st.scale;
+    snap.breathScale = st.breathScale;
+    snap.speak = st.speak;
+    snap.blink = st.blink;
+    snap.isBreathing = st.isBreathing;
+    snap.viseme = st.viseme;
+    snap.speakOnsetNs = st.speakOnsetNs;
+    snap.debug = st.debug;
+    snap.showContextMenu = st.showContextMenu;
+    snap.contextMenuX = st.contextMenuX;
+    snap.contextMenuY = st.contextMenuY;
+    snap.bgColor = ctx.cfg.bgColor;
+    snap.cpuFilter = ctx.cfg.cpuFilter;
+    snap.shakingAmp = ctx.cfg.shakingAmp;
+    snap.shakingFreq = ctx.cfg.shakingFreq;
+    snap.fps = ctx.cfg.fps;
+    snap.pace = st.pacer.stats();
+    snap.vsync = st.pacer.vsync();
+    std::copy(std::begin(st.stageSummary), std::end(st.stageSummary), snap.stages);
+    snap.stageWindow = st.stageWindow;
+    ctx.state->snapshots.publish();
+}
+
+static void renderFrame(AppContext& ctx, const RenderSnapshot& snap, int frameIndex) {
+    Uint64 start = SDL_GetPerformanceCounter();
     switch (ctx.cfg.useCpuRendering) {
     case true:
-        renderFrameCpu(ctx, frameIndex);
+        renderFrameCpu(ctx, snap, frameIndex);
         break;
     default:
-        renderFrameGpu(ctx, frameIndex);
+        renderFrameGpu(ctx, snap, frameIndex);
+    }
+    ctx.state->renderTicks += SDL_GetPerformanceCounter() - start;
+
+    ++ctx.state->renderedFrames;
+    if (ctx.cfg.headlessFrames > 0 && ctx.state->renderedFrames >= ctx.cfg.headlessFrames) {
+        ctx.state->running = false;
     }
 }
 
-static void maybeRender(AppContext& ctx) {
-    int frameIndex = (ctx.state->speak ? 1 : 0) + (ctx.state->blink ? 2 : 0);
-    bool needsRender = ctx.state->speak || ctx.state->isBreathing || ctx.state->blink || (ctx.state->prevFrameIndex != frameIndex);
+/**
+ * @brief idleWaitMs Сколько можно спать до события, ничего не пропустив (0 - работать по fps)
+ *
+ * Неподвижный аватар (без дыхания, голоса, моргания и перетаскивания) кадров не рисует,
+ * так что цикл ждёт в SDL_WaitEventTimeout: голос и готовый hot reload присылают wakeEvent,
+ * ввод приходит сам, а до следующего моргания досыпаем по таймауту.
+ */
+static int idleWaitMs(AppContext& ctx) {
+    constexpr Uint32 IDLE_MAX_MS = 1000; // выход по сигналу замечается хотя бы так часто
+    const MainLoopState& st = *ctx.state;
+    if (!ctx.cfg.idleSleep || st.wakeEvent == 0) return 0;
+    // Подгрузку выбранного листа ждать не нужно: готовый лист сам пришлёт wakeEvent
+    if (st.isBreathing || st.speak || st.blink || st.dragging) return 0;
+    {
+        std::lock_guard<std::mutex> lk(ctx.state->renderJobsMutex);
+        if (!ctx.state->renderJobs.empty()) return 0;
+    }
+    const Uint32 elapsed = static_cast<Uint32>(SDL_GetTicks()) - st.lastBlink;
+    const Uint32 untilBlink = elapsed >= BLINK_INTERVAL ? 0 : BLINK_INTERVAL - elapsed;
+    return static_cast<int>(std::clamp<Uint32>(untilBlink, 1, IDLE_MAX_MS));
+}
+
+// Шаг рендера: правки листов и кадр по последнему снимку, если он что-то меняет
+static void renderLatest(AppContext& ctx, bool force = false) {
+    runRenderJobs(ctx);
+    updateSpriteResidency(ctx);
+
+    const bool fresh = ctx.state->snapshots.acquire();
+    const RenderSnapshot& snap = ctx.state->snapshots.front();
+    const SpriteList& sp = ctx.sprites[ctx.state->currentSpriteIndex];
+    int frameIndex = spriteFrameIndex(sp, snap.speak, snap.viseme, snap.blink);
+    bool needsRender = snap.speak || snap.isBreathing || snap.blink || (ctx.state->prevFrameIndex != frameIndex);
 
-    if (!needsRender) return;
+    if (!force && (!fresh || !needsRender)) return;
     ctx.state->prevFrameIndex = frameIndex;
 
-    renderFrame(ctx, frameIndex);
+    renderFrame(ctx, snap, frameIndex);
 }
 
+// Поток рендера без окна: просыпается на каждый новый снимок и рисует последний
+static void renderLoop(AppContext& ctx) {
+    uint32_t seen = ctx.state->snapshots.sequence();
+    renderLatest(ctx, true);
+    while (ctx.state->running) {
+        ctx.state->snapshots.wait(seen);
+        seen = ctx.state->snapshots.sequence();
+        if (ctx.state->running) renderLatest(ctx);
+    }
+}
+
+/**
+ * @brief runMainLoop Симуляция в главном потоке, рендер - по снимкам из неё
+ *
+ * Без окна рендер и кодирование WebP идут в своём потоке. С окном SDL требует рисовать
+ * и показывать кадр из главного потока, там рендер остаётся, но тоже берёт только снимок.
+ */
 static void runMainLoop(AppContext& ctx) {
     initializeMainLoopState(ctx);
-    
-    renderFrame(ctx, 0);
+    publishRenderSnapshot(ctx);
+
+    std::thread renderer;
+    if (ctx.cfg.headless) renderer = std::thread([&ctx]() { renderLoop(ctx); });
+    else renderLatest(ctx, true);
 
     while (ctx.state->running) {
-        Uint32 frameStart = SDL_GetTicks();
-        // lws_service(context, 0); fixme: занести контекст в MainLoopState
-        handleEvents(ctx);
+        {
+            // Сон в ожидании события - не работа этапа, такие проходы не меряются
+            ScopedStageTimer timer(ctx.state->idleWaitMs == 0 ? &ctx.state->stages : nullptr, Stage::Events);
+            handleEvents(ctx, ctx.state->idleWaitMs);
+        }
+        if (ctx.watcher) ctx.watcher->poll();
         updateTiming(ctx);
-        updateAudioState(ctx);
-        updateBreathing(ctx);
-        updateBlinking(ctx);
-        maybeRender(ctx);
-        Uint32 frameTime = SDL_GetTicks() - frameStart;
-        Uint32 target = 1000 / ctx.cfg.fps;
-        if (frameTime < target) {
-            SDL_Delay(target - frameTime);
+        {
+            ScopedStageTimer timer(&ctx.state->stages, Stage::Audio);
+            updateAudioState(ctx);
+        }
+        {
+            ScopedStageTimer timer(&ctx.state->stages, Stage::Breathing);
+            updateBreathing(ctx);
         }
-        frameStart = SDL_GetTicks();
+        updateBlinking(ctx);
+        collectStageTimings(ctx);
+        publishRenderSnapshot(ctx);
+        const int rendered = ctx.state->renderedFrames;
+        if (!renderer.joinable()) renderLatest(ctx);
+        ctx.state->pacer.setRate(ctx.cfg.fps);
+        ctx.state->idleWaitMs = idleWaitMs(ctx);
+        if (ctx.state->idleWaitMs > 0) ctx.state->pacer.restart(); // спим в handleEvents
+        else ctx.state->pacer.wait(ctx.state->renderedFrames != rendered);
 
         if (!g_globalRunning) {
             ctx.state->running = false;
         }
 
-        if (ctx.state->showContextMenu) {
+        if (ctx.state->showContextMenu && ctx.ren) {
             SDL_SetRenderDrawColor(ctx.ren, 50, 50, 50, 255);
             SDL_FRect menuRect = { static_cast<float>(ctx.state->contextMenuX), static_cast<float>(ctx.state->contextMenuY), 150.0f, 100.0f };
             SDL_RenderFillRect(ctx.ren, &menuRect);        
         }
     }
+
+    if (renderer.joinable()) {
+        publishRenderSnapshot(ctx); // будит поток рендера, чтобы он увидел running == false
+        renderer.join();
+    }
 }
 
 
+// Шрифт меню и текста этапов: из конфига, а если он не открылся - прежний consola.ttf
+static TTF_Font* openMenuFont(const AppConfig& cfg) {
+    static const char* const DEFAULT_FONT = "C:\\Windows\\Fonts\\consola.ttf";
+    TTF_Font* font = nullptr;
+    if (!cfg.fontPath.empty()) {
+        font = TTF_OpenFont(cfg.fontPath.c_str(), 16);
+        if (!font) std::cerr << "Failed to open font " << cfg.fontPath << ": " << SDL_GetError() << '\n';
+    }
+    if (!font) font = TTF_OpenFont(DEFAULT_FONT, 16);
+    if (!font) std::cerr << "No font for the menu and stage timings, text is not drawn (set font in config.ini)\n";
+    return font;
+}
+
 SDL_Surface* loadAndConvert(const char* path, SDL_PixelFormat& targetFormat) {
     SDL_Surface* src = IMG_Load(path);
     if (!src) return nullptr;
@@ -520,19 +1515,50 @@ SDL_Surface* loadAndConvert(const char* path, SDL_PixelFormat& targetFormat) {
     return dst;
 }
 
+// Без окна и дисплея: видео-подсистема не поднимается, кадр рисуется в свой буфер
+static bool initHeadless(AppContext& ctx, const AppConfig& cfg) {
+    const int w = std::max(1, cfg.windowWidth);
+    const int h = std::max(1, cfg.windowHeight);
+    ctx.headlessPixels.assign(static_cast<size_t>(w) * h, 0);
+    // RGBA32 - байты R, G, B, A в памяти при любом порядке байт, как и ждёт WebPEncodeRGBA
+    ctx.winSurface = SDL_CreateSurfaceFrom(w, h, SDL_PIXELFORMAT_RGBA32, ctx.headlessPixels.data(), w * 4);
+    if (!ctx.winSurface) {
+        std::cerr << "Failed to create headless surface: " << SDL_GetError() << '\n';
+        return false;
+    }
+
+    loadSpritesCpu(ctx.sprites, ctx.keymap, cfg.spriteDir, ctx, cfg.alignment);
+    if (ctx.sprites.empty()) {
+        std::cerr << "No PNG sprites found.\n";
+        return false;
+    }
+    std::cout << "Headless render " << w << "x" << h << ": " << ctx.nThreads << " threads, "
+              << cpuSimdLevelName(detectCpuSimdLevel()) << " kernel\n";
+    ctx.cpuFrameCache = createCpuFrameCache(ctx, cfg.frameCacheMB);
+    return true;
+}
+
 static bool initSDL(AppContext& ctx, const AppConfig& cfg) {
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
+    const SDL_InitFlags flags = cfg.headless ? SDL_INIT_AUDIO : (SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+    if (SDL_Init(flags) < 0) {
         std::cerr << "SDL_Init failed: " << SDL_GetError() << '\n';
         return false;
     }
 
     TTF_Init();
+    ctx.state->wakeEvent = SDL_RegisterEvents(1);
 
     Uint8 r = (ctx.cfg.bgColor >> 16) & 0xFF;
     Uint8 g = (ctx.cfg.bgColor >> 8) & 0xFF;
     Uint8 b = (ctx.cfg.bgColor >> 0) & 0xFF;
 
-    if (cfg.useCpuRendering) {
+    if (cfg.headless) {
+        if (!initHeadless(ctx, cfg)) {
+            SDL_Quit();
+            return false;
+        }
+    }
+    else if (cfg.useCpuRendering) {
         ctx.win = SDL_CreateWindow(APP_NAME.c_str(), cfg.windowWidth, cfg.windowHeight, SDL_WINDOW_RESIZABLE & SDL_WINDOWPOS_CENTERED);
         if (!ctx.win) { /* ошибка */ }
 
@@ -544,6 +1570,10 @@ static bool initSDL(AppContext& ctx, const AppConfig& cfg) {
         }
 
         loadSpritesCpu(ctx.sprites, ctx.keymap, cfg.spriteDir, ctx, cfg.alignment);
+        std::cout << "CPU render: " << ctx.nThreads << " threads, "
+                  << cpuSimdLevelName(detectCpuSimdLevel()) << " kernel\n";
+        ctx.state->menuFont = openMenuFont(cfg); // время этапов поверх кадра
+        ctx.cpuFrameCache = createCpuFrameCache(ctx, cfg.frameCacheMB);
     }
     else {
 
@@ -585,7 +1615,8 @@ static bool initSDL(AppContext& ctx, const AppConfig& cfg) {
         //    SDL_DestroyTexture(loading);
         //}
 
-        loadSprites(ctx.ren, cfg.spriteDir, ctx.sprites, ctx.keymap, cfg.alignment);
+        loadSprites(ctx.ren, cfg.spriteDir, ctx.sprites, ctx.keymap, cfg.alignment, ctx.pool, cfg.spriteCachePath,
+                    cfg.spriteAtlas ? &ctx.atlasPages : nullptr, cfg.spriteBudgetMB);
         if (ctx.sprites.empty()) {
             std::cerr << "No PNG sprites found.\n";
             SDL_DestroyRenderer(ctx.ren);
@@ -594,24 +1625,22 @@ static bool initSDL(AppContext& ctx, const AppConfig& cfg) {
             return false;
         }
 
-        ctx.state->menuFont = TTF_OpenFont("C:\\Windows\\Fonts\\consola.ttf", 16);
+        ctx.state->menuFont = openMenuFont(cfg);
         updateContextMenuTextures(ctx);
     }
+    applyVsync(ctx);
 
-    SDL_AudioSpec spec{};
-    spec.format = SDL_AUDIO_F32;
-    spec.channels = 1;
-    spec.freq = 8000;
     SDL_AudioDeviceID dev = findMicByName(cfg.micName);
-    ctx.stream = SDL_OpenAudioDeviceStream(dev, &spec, nullptr, nullptr);
-    if (ctx.stream) {
-        if (SDL_ResumeAudioStreamDevice(ctx.stream) < 0) {
-            std::cerr << "Failed to start audio stream: " << SDL_GetError() << '\n';
-            ctx.stream = nullptr;
-        }
-        else {
-            std::cout << "Audio capture started\n";
-        }
+    ctx.audio = new AudioCapture();
+    ctx.audio->setVisemes(cfg.visemes);
+    ctx.audio->setWakeEvent(ctx.state->wakeEvent);
+    if (ctx.audio->open(dev, vadParamsFrom(cfg))) {
+        std::cout << "Audio capture started\n";
+    }
+    else {
+        std::cerr << "Failed to start audio stream: " << SDL_GetError() << '\n';
+        delete ctx.audio;
+        ctx.audio = nullptr;
     }
 
     return true;
@@ -640,14 +1669,31 @@ fs::path getExecutableDir() { // должно решать баг с пропа
 #endif
 }
 
+// --headless - без окна (см. AppConfig::headless), --frames N - выйти после N кадров,
+// --latency - замер задержки от микрофона до экрана (см. AppConfig::latencyProbe)
+static void applyCommandLine(AppConfig& cfg, int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--headless") cfg.headless = true;
+        else if (arg == "--frames" && i + 1 < argc) cfg.headlessFrames = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--latency") cfg.latencyProbe = true;
+        else std::cerr << "Unknown argument: " << arg << '\n';
+    }
+    if (cfg.headless) cfg.useCpuRendering = true; // рендерера нет, рисует CPU-растеризатор
+}
+
 int main(int argc, char** argv) {
-    (void)argc; (void)argv;
     fs::path exeDir = getExecutableDir();
     AppConfig cfg = loadConfig(exeDir);
+    applyCommandLine(cfg, argc, argv);
 
     AppContext ctx;
     ctx.nThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency() / 2) + 1);
+    if (cfg.numberOfThreadsForCpuRender > 0) {
+        ctx.nThreads = static_cast<unsigned int>(cfg.numberOfThreadsForCpuRender);
+    }
     ctx.cfg = cfg;
+    ctx.pool = new ThreadPool(ctx.nThreads);
 
     MainLoopState* state = new MainLoopState();
     ctx.state = state;
@@ -685,6 +1731,8 @@ int main(int argc, char** argv) {
         lws_context_destroy(context);
         return -1;
     }
+    ctx.stream = new FrameStream(context, &state->stages);
+    ctx.stream->start();
 
     // if (cfg.globalHookingAcceptable) {
     //     InstallGlobalKeyboardHook(); // загружается та версия хука, которая нужна платформе (точнее будет, как сделаю)
@@ -711,22 +1759,53 @@ int main(int argc, char** argv) {
 
     if (!initSDL(ctx, cfg)) {
         UninstallGlobalKeyboardHook();
+        delete ctx.stream;
         return 1;
     }
 
+    initSpriteResidency(ctx);
+    initHotReload(ctx, exeDir);
+    if (cfg.latencyProbe && ctx.audio) ctx.latency = new LatencyHistogram();
+
     g_globalRunning = true;
 
     runMainLoop(ctx);
 
     // UninstallGlobalKeyboardHook();
 
-    if (ctx.stream) SDL_DestroyAudioStream(ctx.stream);
+    if (ctx.audio && ctx.audio->dropped() > 0) {
+        std::cout << "Audio: " << ctx.audio->dropped() << " samples dropped\n";
+    }
+    delete ctx.audio;
+    if (ctx.latency) {
+        if (ctx.latency->count() > 0 && ctx.latency->dump(cfg.latencyLogPath, "mic-to-photon latency")) {
+            std::cout << "Mic-to-photon: p50 " << ctx.latency->percentileMs(0.50) << " ms, p95 "
+                      << ctx.latency->percentileMs(0.95) << " ms, p99 " << ctx.latency->percentileMs(0.99)
+                      << " ms, written to " << cfg.latencyLogPath << '\n';
+        }
+        delete ctx.latency;
+    }
+    delete ctx.watcher; // до листов: его поток может ещё декодировать
+    delete ctx.stageLog;
+    delete ctx.residency;
+    delete ctx.cpuFrameCache;
+    if (cfg.headless) {
+        if (state->renderedFrames > 0) {
+            double ms = 1000.0 * state->renderTicks / SDL_GetPerformanceFrequency() / state->renderedFrames;
+            std::cout << "Headless: " << state->renderedFrames << " frames, " << ms << " ms/frame\n";
+        }
+        SDL_DestroySurface(ctx.winSurface);
+    }
     for (auto& s : ctx.sprites) {
         if (s.tex) SDL_DestroyTexture(s.tex);
+        for (SDL_Texture* mipTex : s.mipTextures) SDL_DestroyTexture(mipTex);
     }
+    for (SDL_Texture* page : ctx.atlasPages) SDL_DestroyTexture(page);
     SDL_DestroyRenderer(ctx.ren);
     SDL_DestroyWindow(ctx.win);
+    delete ctx.stream; // его поток обслуживает контекст
     lws_context_destroy(context);
+    delete ctx.pool;
     SDL_Quit();
     return 0;
 }
@@ -11,22 +11,68 @@
 #include <cstring>
 #include <functional>
 #include "sockets.h"
+#include "frame_stream.h"
+#include "render.h"
+#include "resample.h"
+#include "thread_pool.h"
+#include "frame_cache.h"
+#include "sprite_cache.h"
+#include "sprite_residency.h"
+#include "atlas.h"
+#include "file_watcher.h"
+#include "alpha_spans.h"
+#include "audio.h"
+#include "latency.h"
+#include "frame_pacer.h"
+#include "triple_buffer.h"
+#include "stage_timing.h"
+#include <atomic>
+#include <mutex>
+#include <memory>
 
 
 constexpr double PI = 3.141592653589793;
 
+// Лист - сетка кадров cols x rows (по умолчанию 2x2, иначе суффикс имени файла "@4x2").
+// Столбец - форма рта (0 - закрыт, 1 - А, 2 - Э/И, 3 - О/У), строка - глаза (0 - открыты, 1 - моргание)
+constexpr int MAX_SPRITE_FRAMES = SPRITE_CACHE_MAX_FRAMES;
+
 struct SpriteList {
     SDL_Texture* tex = nullptr;
     SDL_Surface* surface = nullptr;
     int w = 0, h = 0;
     std::string name;
-    float baseOffsetX[4] = { 0,0,0,0 };
-    float baseOffsetY[4] = { 0,0,0,0 };
+    std::string sourcePath; // PNG, из которого лист подгружается заново после выгрузки
+    int cols = 2, rows = 2;
+    float baseOffsetX[MAX_SPRITE_FRAMES] = {};
+    float baseOffsetY[MAX_SPRITE_FRAMES] = {};
+    // Мипмапы, уровни 1..N (уровень 0 - surface/tex), каждый вдвое меньше предыдущего
+    std::vector<SDL_Surface*> mips;
+    std::vector<SDL_Texture*> mipTextures;
+    // Лист в общем атласе (GPU): [уровень mip][кадр]; тогда tex и mipTextures пустые
+    std::vector<std::vector<AtlasFrame>> atlasFrames;
+    // Отрезки альфы по уровням [0 - surface, 1.. - mips]; строятся только для CPU-рендера
+    std::vector<AlphaSpanIndex> alphaSpans;
+    // Владелец пикселей, если они не у SDL (например, отображённый в память кэш листов)
+    std::shared_ptr<void> pixelStore;
+    // Запись в кэше листов (тогда pixelStore - этот SpriteCache): после выгрузки лист берётся из неё, а не из PNG
+    int cacheEntry = -1;
 };
 
 enum class SpriteAlignment{
     AsIs,       // как есть (без изменений)
-    Centered    // центрировать по bounding box
+    Centered,   // центрировать по bounding box
+    Centroid    // центрировать по центру масс альфы (с точностью до долей пикселя)
+};
+
+enum class CpuFilter {
+    Nearest,    // ближайший сосед - самый дешёвый, для пиксель-арта
+    Bilinear,   // билинейная интерполяция
+    Box,        // среднее по площади пикселя - мягче при уменьшении
+    // Двухпроходный ресэмплер с таблицами весов (resample.h)
+    Triangle,   // билинейный, при уменьшении учитывает весь след пикселя
+    Bicubic,
+    Lanczos     // самый чёткий и самый дорогой
 };
 
 
@@ -39,6 +85,12 @@ struct AppConfig {
     std::string micName = "default";
     float micThreshold = 0.0075f;
     float micGain = 1.0f;
+    float micHysteresis = 0.6f; // рот закрывается, когда огибающая ниже micThreshold * micHysteresis
+    float micAttackMs = 5.0f;
+    float micReleaseMs = 60.0f;
+    int micHopMs = 5; // шаг детектора голоса; задержка открытия рта - порядка шага
+    bool micAutoCalibrate = false; // порог не ниже уровня шума в паузах (с запасом)
+    bool visemes = true; // форма рта по спектру голоса (для листов больше чем в 2 столбца)
     std::string spriteDir;
     bool enableBreathing = true;
     float breathingAmp = 1.0f;
@@ -46,12 +98,27 @@ struct AppConfig {
     bool enableShaking = true;
     float shakingAmp = 1.0f;
     float shakingFreq = 1.0f;
-    int fps = 60; // vsync?
+    int fps = 60;
+    bool vsync = false; // показ кадра ждёт экран; fps выше частоты экрана тогда не получить
+    bool idleSleep = true; // аватар неподвижен - спать до события вместо fps пробуждений в секунду
     bool globalHookingAcceptable = false;
     bool useCpuRendering = false;
+    bool headless = false; // без окна: CPU-рендер в свой буфер windowWidth x windowHeight, только стрим
+    int headlessFrames = 0; // --frames N: выйти после N кадров (для замеров), 0 - без ограничения
     SpriteAlignment alignment = SpriteAlignment::Centered;
-    bool usebilinearinterpolationoncpu = true; // требует изменения алгоритма
-    int numberOfThreadsForCpuRender = -1; // то есть автоматическое определение (должно быть (потом))
+    CpuFilter cpuFilter = CpuFilter::Bilinear;
+    int frameCacheMB = 0; // CPU-рендер: память под готовые кадры, 0 - кэш выключен
+    bool spriteCache = true; // декодированные листы в sprites.cache рядом с config.ini
+    int spriteBudgetMB = 0; // память под листы (ОЗУ или видеопамять), 0 - держать все
+    int spritePrefetch = 3; // сколько последних выбранных клавишами листов держать загруженными
+    bool spriteAtlas = false; // GPU: обрезанные кадры всех листов в общих страницах атласа
+    bool hotReload = true; // перечитывать изменённые PNG и config.ini на лету (Linux)
+    std::string spriteCachePath; // не ключ конфига, выставляется в loadConfig
+    bool latencyProbe = false; // замер задержки от звука до открытого рта на экране (--latency)
+    std::string latencyLogPath; // куда сохранить гистограмму при выходе, выставляется в loadConfig
+    std::string stageLogPath; // сводки времени этапов раз в секунду (.csv или .json), пусто - не писать
+    std::string fontPath; // TTF для меню и текста этапов, пусто - consola.ttf из Windows
+    int numberOfThreadsForCpuRender = -1; // -1 - автоматическое определение (AppContext::nThreads)
 };
 
 struct ContextMenuItem {
@@ -59,22 +126,50 @@ struct ContextMenuItem {
     std::function<void()> action;
 };
 
-struct RawPixels {
-    uint8_t* pixels = nullptr;
-    size_t size = 0;
-};
 
+/**
+ * @brief RenderSnapshot Всё, что рендер берёт у симуляции для одного кадра
+ *
+ * Симуляция (ввод, звук, дыхание, моргание) заполняет снимок целиком и публикует его
+ * через TripleBuffer; рендер читает только его, поэтому дорогой кадр или кодирование WebP
+ * не задерживают ввод и звук. Листы, кэши и WebSocket принадлежат рендеру.
+ */
+struct RenderSnapshot {
+    double globalTime = 0.0;
+    float offsetX = 0.0f, offsetY = 0.0f;
+    float scale = 1.0f;
+    float breathScale = 1.0f;
+    bool speak = false;
+    bool blink = false;
+    bool isBreathing = false;
+    Viseme viseme = Viseme::Rest;
+    Uint64 speakOnsetNs = 0;
+    bool debug = false;
+    bool showContextMenu = false;
+    int contextMenuX = 0, contextMenuY = 0;
+    // Настройки, которые меняются на лету из config.ini
+    Uint32 bgColor = 0;
+    CpuFilter cpuFilter = CpuFilter::Bilinear;
+    float shakingAmp = 0.0f, shakingFreq = 0.0f;
+    int fps = 60;
+    PacingStats pace;
+    bool vsync = false;
+    // Время этапов за последнее окно; stageWindow растёт с каждым новым окном
+    StageSummary stages[STAGE_COUNT];
+    uint32_t stageWindow = 0;
+};
 
 struct MainLoopState {
-    bool running = true;
+    std::atomic<bool> running{ true };
     bool debug = false;
     bool speak = false;
     bool prevSpeak = false;
     bool blink = false;
     bool isBreathing = false;
-    bool webDisplaying = false;
 
     int currentSpriteIndex = 0;
+    int pendingSpriteIndex = -1; // выбран, но ещё грузится - до тех пор показывается текущий
+    std::vector<int> recentSprites; // выбранные клавишами, последний - первым
     int prevFrameIndex = -1;
 
     double dt = 0.0;
@@ -83,8 +178,22 @@ struct MainLoopState {
     double breathPhase = 0.0;
     float breathScale = 1.0f;
 
-    RawPixels currentFrameRawPixels;
-    struct lws* wsi = nullptr;
+    std::atomic<int> renderedFrames{ 0 };
+    Uint64 renderTicks = 0; // суммарное время рендера, в тиках SDL_GetPerformanceCounter
+    Viseme viseme = Viseme::Rest;
+    FramePacer pacer;
+    Uint32 wakeEvent = 0; // своё событие SDL: звук, наблюдатель и т.п. будят цикл из простоя
+    int idleWaitMs = 0; // сколько следующий handleEvents может ждать событие (0 - не ждать)
+    Uint64 speakOnsetNs = 0; // захват звука, открывшего рот (0 - рот закрыт)
+    Uint64 shownOnsetNs = 0; // рендер: чья задержка уже записана в гистограмму
+    TripleBuffer<RenderSnapshot> snapshots;
+    StageTimings stages; // пишут оба потока, сводки собирает симуляция
+    StageSummary stageSummary[STAGE_COUNT];
+    uint32_t stageWindow = 0;
+    Uint64 stageWindowStart = 0;
+    // Правки листов и кэшей от симуляции и наблюдателя - рендер выполняет их перед кадром
+    std::mutex renderJobsMutex;
+    std::vector<std::function<void()>> renderJobs;
 
     Uint32 lastBlink = 0;
     Uint32 blinkStart = 0;
@@ -113,17 +222,57 @@ struct MainLoopState {
     std::vector<SDL_Texture*> contextMenuTextures;
     TTF_Font* menuFont = nullptr;
 
+    // Кадры, показанные за последнюю секунду, для отладочного текста; окно растёт раз в секунду
+    Uint64 debugFpsStart = 0;
+    int debugFrames = 0;
+    int debugFps = 0;
+    uint32_t debugFpsWindow = 0;
+
+    std::vector<SDL_Rect> renderTiles; // переиспользуется между кадрами
+    ResampleTable resampleCols, resampleRows; // пересчитываются только при смене геометрии
+
+    // CPU-рендер рисует прямо в поверхность окна: её содержимое живёт между кадрами,
+    // перерисовываются только грязные прямоугольники
+    SDL_Rect prevSpriteRect{ 0, 0, 0, 0 };
+    SDL_Rect prevMenuRect{ 0, 0, 0, 0 };
+    bool cpuFullRedraw = true;
+    std::vector<Uint32> cpuBlockSpare; // буфер вытесненного из кэша кадров блока, ждёт следующего промаха
+    // Строки отладочного текста CPU-рендера; пересоздаются с новым окном сводки этапов или fps
+    std::vector<SDL_Surface*> cpuOverlayLines;
+    SDL_Rect cpuOverlayRect{ 0, 0, 0, 0 };
+    uint32_t cpuOverlayWindow = 0;
+    uint32_t cpuOverlayFpsWindow = 0;
+    // То же для GPU-рендера: текстуры строк живут между кадрами
+    std::vector<SDL_Texture*> gpuOverlayLines;
+    uint32_t gpuOverlayWindow = 0;
+    uint32_t gpuOverlayFpsWindow = 0;
+
+};
+
+// Спрайт с фоном, отрисованный в кэш кадров CPU-рендера
+struct CpuFrameBlock {
+    std::vector<Uint32> pixels;
+    int w = 0, h = 0;
 };
 
 struct AppContext { // todo: Выделить структуры нормально
-    SDL_Window* win;
-    SDL_Renderer* ren;
-    SDL_Surface* winSurface = nullptr;
-    SDL_AudioStream* stream;
+    SDL_Window* win = nullptr;
+    SDL_Renderer* ren = nullptr;
+    SDL_Surface* winSurface = nullptr; // в headless-режиме - своя поверхность поверх headlessPixels
+    std::vector<Uint32> headlessPixels;
+    AudioCapture* audio = nullptr;
     std::vector<SpriteList> sprites;
     std::unordered_map<SDL_Keycode, size_t> keymap;
     AppConfig cfg;
     unsigned int nThreads;
+    ThreadPool* pool = nullptr;
+    SpriteResidency* residency = nullptr;
+    FileWatcher* watcher = nullptr;
+    LatencyHistogram* latency = nullptr; // только в режиме latencyProbe
+    FrameStream* stream = nullptr; // WebSocket: свой поток кодирует и отправляет кадры
+    StageLogWriter* stageLog = nullptr; // создаётся с первым окном, если задан stageLog
+    std::vector<SDL_Texture*> atlasPages;
+    FrameCache<CpuFrameBlock>* cpuFrameCache = nullptr;
     std::vector<ContextMenuItem> contextMenuItems;
     MainLoopState* state;
 };
@@ -164,23 +313,24 @@ static bool parseBool(const std::string& s) {
 struct RenderGeometry {
     float dstX, dstY;
     float dstW, dstH;
-    int srcX, srcY, srcW, srcH;
+    int srcX, srcY, srcW, srcH; // в координатах уровня mip
+    int mip;
 };
 
 RenderGeometry computeRenderGeometry(
     int spriteW, int spriteH,
     int winW, int winH,
-    const AppContext& ctx,
+    const RenderSnapshot& snap,
     int frameIndex,
     float shakingAmp,
     float shakingFreq,
-    float baseOffsetX[] = {0}, float baseOffsetY[] = {0}
+    float baseOffsetX[] = {0}, float baseOffsetY[] = {0},
+    int mipLevels = 1,
+    int cols = 2, int rows = 2,
+    float breathStep = 0.0f // шаг квантования дыхания, 0 - без квантования
 ) {
-    int quadW = spriteW / 2;
-    int quadH = spriteH / 2;
-
-    int srcX = (frameIndex % 2) * quadW;
-    int srcY = (frameIndex / 2) * quadH;
+    int quadW = spriteW / cols;
+    int quadH = spriteH / rows;
 
     float ibaseOffsetX = baseOffsetX[frameIndex];
     float ibaseOffsetY = baseOffsetY[frameIndex];
@@ -188,22 +338,38 @@ RenderGeometry computeRenderGeometry(
     float aspect = static_cast<float>(quadW) / quadH;
     int dstW = std::min(winW, static_cast<int>(winH * aspect));
     int dstH = std::min(winH, static_cast<int>(winW / aspect));
-    float baseW = static_cast<float>(dstW) * ctx.state->breathScale;
-    float baseH = static_cast<float>(dstH) * ctx.state->breathScale;
-    float finalW = baseW * ctx.state->scale;
-    float finalH = baseH * ctx.state->scale;
-
-    float dstX = (static_cast<float>(winW) - finalW) / 2.0f + ctx.state->offsetX + ibaseOffsetX * ctx.state->scale;
-    float dstY = (static_cast<float>(winH) - finalH) / 2.0f + ctx.state->offsetY + ibaseOffsetY * ctx.state->scale;
-
-    if ((shakingAmp > 0.0f) && (shakingFreq > 0.0f) && ctx.state->speak) {
-        float ox = static_cast<float>(std::sin(ctx.state->globalTime * (50.0f * shakingFreq) * PI) * 2.0f * (shakingAmp / 2.0f));
-        float oy = static_cast<float>(std::cos(ctx.state->globalTime * (36.0f * shakingFreq) * PI) * 1.0f * (shakingAmp / 2.0f));
+    float breath = snap.breathScale;
+    if (breathStep > 0.0f) breath = 1.0f + std::round((breath - 1.0f) / breathStep) * breathStep;
+    float baseW = static_cast<float>(dstW) * breath;
+    float baseH = static_cast<float>(dstH) * breath;
+    float finalW = baseW * snap.scale;
+    float finalH = baseH * snap.scale;
+
+    float dstX = (static_cast<float>(winW) - finalW) / 2.0f + snap.offsetX + ibaseOffsetX * snap.scale;
+    float dstY = (static_cast<float>(winH) - finalH) / 2.0f + snap.offsetY + ibaseOffsetY * snap.scale;
+
+    if ((shakingAmp > 0.0f) && (shakingFreq > 0.0f) && snap.speak) {
+        float ox = static_cast<float>(std::sin(snap.globalTime * (50.0f * shakingFreq) * PI) * 2.0f * (shakingAmp / 2.0f));
+        float oy = static_cast<float>(std::cos(snap.globalTime * (36.0f * shakingFreq) * PI) * 1.0f * (shakingAmp / 2.0f));
         dstX += ox;
         dstY += oy;
     }
 
-    return { dstX, dstY, finalW, finalH, srcX, srcY, quadW, quadH };
+    // Самый мелкий уровень, который ещё не меньше области вывода:
+    // билинейка тогда сжимает не больше чем вдвое и не даёт алиасинга
+    int mip = 0;
+    float ratio = std::min(quadW / std::max(finalW, 1.0f), quadH / std::max(finalH, 1.0f));
+    while (mip + 1 < mipLevels && ratio >= 2.0f) {
+        ratio *= 0.5f;
+        ++mip;
+    }
+    quadW = (spriteW >> mip) / cols;
+    quadH = (spriteH >> mip) / rows;
+
+    int srcX = (frameIndex % cols) * quadW;
+    int srcY = (frameIndex / cols) * quadH;
+
+    return { dstX, dstY, finalW, finalH, srcX, srcY, quadW, quadH, mip };
 }
 
 void updateContextMenuTextures(AppContext& ctx) {
@@ -227,7 +393,164 @@ void updateContextMenuTextures(AppContext& ctx) {
     }
 }
 
-static void renderFrameGpu(AppContext& ctx, int frameIndex) {
+static int spriteMipLevels(const SpriteList& sp) {
+    if (!sp.atlasFrames.empty()) return static_cast<int>(sp.atlasFrames.size());
+    return 1 + static_cast<int>(sp.surface ? sp.mips.size() : sp.mipTextures.size());
+}
+
+static SDL_Surface* spriteMipSurface(const SpriteList& sp, int mip) {
+    return mip == 0 ? sp.surface : sp.mips[mip - 1];
+}
+
+static SDL_Texture* spriteMipTexture(const SpriteList& sp, int mip) {
+    return mip == 0 ? sp.tex : sp.mipTextures[mip - 1];
+}
+
+// С кэшем кадров дыхание идёт ступенями по 1% (7 размеров на вдох при ±3%),
+// иначе каждый кадр вдоха - новый размер и новый ключ, и LRU ничего не удерживает
+constexpr float BREATH_CACHE_STEP = 0.01f;
+
+// С кэшем кадров геометрия округляется до целых пикселей: ключ строится по ней,
+// и одинаковый ключ обязан давать одинаковые пиксели
+static void snapGeometryForCache(RenderGeometry& geom) {
+    geom.dstX = std::round(geom.dstX);
+    geom.dstY = std::round(geom.dstY);
+    geom.dstW = std::max(1.0f, std::round(geom.dstW));
+    geom.dstH = std::max(1.0f, std::round(geom.dstH));
+}
+
+// Рисует кадр спрайта в dst текущей цели. Из атласа рисуется только непрозрачная часть,
+// пересчитанная в ту же систему координат
+static void drawSpriteFrame(AppContext& ctx, const SpriteList& sp, const RenderGeometry& geom, int frameIndex,
+                            const SDL_FRect& dst) {
+    SDL_Texture* tex = nullptr;
+    SDL_FRect src{ static_cast<float>(geom.srcX), static_cast<float>(geom.srcY),
+                   static_cast<float>(geom.srcW), static_cast<float>(geom.srcH) };
+    SDL_FRect out = dst;
+    if (!sp.atlasFrames.empty()) {
+        const AtlasFrame& f = sp.atlasFrames[geom.mip][frameIndex];
+        if (f.crop.w <= 0 || f.crop.h <= 0) return;
+        tex = ctx.atlasPages[f.page];
+        src = { static_cast<float>(f.rect.x), static_cast<float>(f.rect.y),
+                static_cast<float>(f.rect.w), static_cast<float>(f.rect.h) };
+        const float sx = dst.w / geom.srcW;
+        const float sy = dst.h / geom.srcH;
+        out = { dst.x + f.crop.x * sx, dst.y + f.crop.y * sy, f.crop.w * sx, f.crop.h * sy };
+    }
+    else {
+        tex = spriteMipTexture(sp, geom.mip);
+    }
+
+    SDL_RenderTexture(ctx.ren, tex, &src, &out);
+}
+
+// Кадр листа: форма рта, которой в листе нет, заменяется просто открытым ртом
+static int spriteFrameIndex(const SpriteList& sp, bool speak, Viseme viseme, bool blink) {
+    int mouth = speak ? std::max(1, static_cast<int>(viseme)) : 0;
+    if (mouth >= sp.cols) mouth = std::min(1, sp.cols - 1);
+    const int eyes = blink && sp.rows > 1 ? 1 : 0;
+    return eyes * sp.cols + mouth;
+}
+
+// Вызывается сразу после показа кадра (без окна - после передачи его потоку стрима): если рот
+// на нём впервые открыт, задержка от захвата звука до показа идёт в гистограмму
+static void notePresented(AppContext& ctx, const RenderSnapshot& snap, int frameIndex) {
+    MainLoopState& st = *ctx.state;
+    if (!ctx.latency || snap.speakOnsetNs == 0 || snap.speakOnsetNs == st.shownOnsetNs) return;
+    if (frameIndex % ctx.sprites[st.currentSpriteIndex].cols == 0) return;
+    const Uint64 now = SDL_GetTicksNS();
+    if (now > snap.speakOnsetNs) ctx.latency->record(now - snap.speakOnsetNs);
+    st.shownOnsetNs = snap.speakOnsetNs;
+}
+
+// Есть ли клиент WebSocket, которому нужен кадр
+static bool streaming(const AppContext& ctx) {
+    return ctx.stream && ctx.stream->connected();
+}
+
+// Строки отладочного текста про этапы: min/avg/p99 за последнее окно
+static int formatStageLines(const RenderSnapshot& snap, char (*lines)[64], int maxLines) {
+    int count = 0;
+    for (int i = 0; i < STAGE_COUNT && count < maxLines; ++i) {
+        const StageSummary& s = snap.stages[i];
+        if (s.count == 0) continue;
+        snprintf(lines[count++], sizeof(lines[0]), "%-9s %.2f/%.2f/%.2f ms", STAGE_NAMES[i], s.minMs, s.avgMs, s.p99Ms);
+    }
+    return count;
+}
+
+// fps, ровность кадров, микрофон и задержка звук-экран - и этапы под ними
+constexpr int DEBUG_LINES = 4 + STAGE_COUNT;
+
+static void countDebugFrame(MainLoopState& st) {
+    const Uint64 now = SDL_GetTicks();
+    ++st.debugFrames;
+    if (now - st.debugFpsStart < 1000) return;
+    st.debugFps = st.debugFrames;
+    st.debugFrames = 0;
+    st.debugFpsStart = now;
+    ++st.debugFpsWindow;
+}
+
+// Все строки отладочного текста; общие для GPU- и CPU-рендера и для консоли
+static int formatDebugLines(const AppContext& ctx, const RenderSnapshot& snap, char (*lines)[64], int maxLines) {
+    int count = 0;
+    snprintf(lines[count++], sizeof(lines[0]), "%d/%d", ctx.state->debugFps, snap.fps);
+    const PacingStats& pace = snap.pace;
+    if (pace.frames > 0 && count < maxLines) {
+        snprintf(lines[count++], sizeof(lines[0]), "pace %.2f sd %.2f max %.1f ms%s",
+                 pace.meanMs, pace.stddevMs, pace.maxMs, snap.vsync ? " vsync" : "");
+    }
+    if (ctx.audio && count < maxLines) {
+        static const char* const VISEME_NAMES[] = { "-", "A", "E", "O" };
+        snprintf(lines[count++], sizeof(lines[0]), "mic %.4f floor %.4f %s",
+                 ctx.audio->level(), ctx.audio->noiseFloor(), VISEME_NAMES[static_cast<int>(snap.viseme)]);
+    }
+    if (ctx.latency && ctx.latency->count() > 0 && count < maxLines) {
+        snprintf(lines[count++], sizeof(lines[0]), "m2p %.1f/%.1f/%.1f ms",
+                 ctx.latency->percentileMs(0.50), ctx.latency->percentileMs(0.95), ctx.latency->percentileMs(0.99));
+    }
+    return count + formatStageLines(snap, lines + count, maxLines - count);
+}
+
+// Без окна или шрифта отладочный текст идёт в консоль
+static void logDebugLines(const AppContext& ctx, const RenderSnapshot& snap) {
+    static Uint64 lastLog = 0;
+    Uint64 now = SDL_GetTicks();
+    if (now - lastLog < 5000) return;
+    lastLog = now;
+    char lines[DEBUG_LINES][64];
+    const int lineCount = formatDebugLines(ctx, snap, lines, DEBUG_LINES);
+    for (int i = 0; i < lineCount; ++i) std::cout << "[debug] " << lines[i] << '\n';
+}
+
+static void clearGpuOverlay(MainLoopState& st) {
+    for (SDL_Texture* line : st.gpuOverlayLines) SDL_DestroyTexture(line);
+    st.gpuOverlayLines.clear();
+}
+
+// Пересоздаёт текстуры отладочного текста только с новым окном сводки этапов или fps
+static void updateGpuOverlay(AppContext& ctx, const RenderSnapshot& snap) {
+    MainLoopState& st = *ctx.state;
+    if (snap.stageWindow == st.gpuOverlayWindow && st.debugFpsWindow == st.gpuOverlayFpsWindow
+        && !st.gpuOverlayLines.empty()) return;
+    clearGpuOverlay(st);
+    st.gpuOverlayWindow = snap.stageWindow;
+    st.gpuOverlayFpsWindow = st.debugFpsWindow;
+
+    char lines[DEBUG_LINES][64];
+    const int lineCount = formatDebugLines(ctx, snap, lines, DEBUG_LINES);
+    SDL_Color color = {255, 50, 50, 255};
+    for (int i = 0; i < lineCount; ++i) {
+        SDL_Surface* surf = TTF_RenderText_Solid(st.menuFont, lines[i], strlen(lines[i]), color);
+        if (!surf) continue;
+        SDL_Texture* tex = SDL_CreateTextureFromSurface(ctx.ren, surf);
+        SDL_DestroySurface(surf);
+        if (tex) st.gpuOverlayLines.push_back(tex);
+    }
+}
+
+static void renderFrameGpu(AppContext& ctx, const RenderSnapshot& snap, int frameIndex) {
     SpriteList& sp = ctx.sprites[ctx.state->currentSpriteIndex];
     int winW, winH;
     SDL_GetWindowSize(ctx.win, &winW, &winH);
@@ -235,45 +558,46 @@ static void renderFrameGpu(AppContext& ctx, int frameIndex) {
     RenderGeometry geom = computeRenderGeometry(
         sp.w, sp.h,
         winW, winH,
-        ctx, frameIndex,
-        ctx.cfg.shakingAmp,
-        ctx.cfg.shakingFreq,
+        snap, frameIndex,
+        snap.shakingAmp,
+        snap.shakingFreq,
         sp.baseOffsetX,
-        sp.baseOffsetY
+        sp.baseOffsetY,
+        spriteMipLevels(sp),
+        sp.cols, sp.rows
     );
 
-    SDL_FRect src{ static_cast<float>(geom.srcX), static_cast<float>(geom.srcY),
-                   static_cast<float>(geom.srcW), static_cast<float>(geom.srcH) };
-    SDL_FRect dst{ geom.dstX, geom.dstY, geom.dstW, geom.dstH };
-
-
-    Uint8 r = (ctx.cfg.bgColor >> 16) & 0xFF;
-    Uint8 g = (ctx.cfg.bgColor >> 8) & 0xFF;
-    Uint8 b = (ctx.cfg.bgColor >> 0) & 0xFF;
-    SDL_SetRenderDrawColor(ctx.ren, r, g, b, 255);
-    SDL_RenderClear(ctx.ren);
-    SDL_RenderTexture(ctx.ren, sp.tex, &src, &dst);
-    if (ctx.state->webDisplaying) {
-
+    {
+        // Команды отрисовки спрайта; сама работа видеокарты досчитывается в present
+        ScopedStageTimer timer(&ctx.state->stages, Stage::Raster);
+        SDL_FRect dst{ geom.dstX, geom.dstY, geom.dstW, geom.dstH };
+
+        Uint8 r = (snap.bgColor >> 16) & 0xFF;
+        Uint8 g = (snap.bgColor >> 8) & 0xFF;
+        Uint8 b = (snap.bgColor >> 0) & 0xFF;
+        SDL_SetRenderDrawColor(ctx.ren, r, g, b, 255);
+        SDL_RenderClear(ctx.ren);
+        drawSpriteFrame(ctx, sp, geom, frameIndex, dst);
+    }
+    if (streaming(ctx)) {
+        // Чтение с видеокарты - здесь, в потоке рендерера; кодирование и отправка - в потоке стрима
+        ScopedStageTimer timer(&ctx.state->stages, Stage::Readback);
         SDL_Surface* surf = SDL_RenderReadPixels(ctx.ren, nullptr);
         if (surf) {
-            size_t size = surf->h * surf->pitch;
-            memcpy(ctx.state->currentFrameRawPixels.pixels, surf->pixels, size);
-            ctx.state->currentFrameRawPixels.size = size;
-            sendWebP(ctx.state->wsi, ctx.state->currentFrameRawPixels.pixels, surf->w, surf->h);
+            ctx.stream->submit(static_cast<const uint8_t*>(surf->pixels), surf->w, surf->h, surf->pitch);
             SDL_DestroySurface(surf);
         }
         //downloadPixelsFromGPUTexture(?, ctx.state->currentFrameRawPixels.pixels, ctx.state->currentFrameRawPixels.size, ctx);
         // тут требуется переход на уровень рендера ниже, придётся писать шейдеры и работать с видюхой прямо
     }
-    if (ctx.state->showContextMenu) {
+    if (snap.showContextMenu) {
         const int menuWidth = 220;
         const int itemHeight = 24;
         const int padding = 8;
         const int menuHeight = static_cast<int>(ctx.contextMenuItems.size()) * itemHeight;
 
-        int menuX = ctx.state->contextMenuX;
-        int menuY = ctx.state->contextMenuY;
+        int menuX = snap.contextMenuX;
+        int menuY = snap.contextMenuY;
 
         int winW, winH;
         SDL_GetWindowSize(ctx.win, &winW, &winH);
@@ -307,112 +631,413 @@ static void renderFrameGpu(AppContext& ctx, int frameIndex) {
             }
         }
     }
-    if (ctx.state->debug) {
-        static Uint32 lastTime = 0;
-        static int frameCount = 0;
-        static int displayedFps = 0;
-        static int targetFps = ctx.cfg.fps;
-
-        Uint32 currentTime = SDL_GetTicks();
-        frameCount++;
-
-        if (currentTime - lastTime >= 1000) {
-            displayedFps = frameCount;
-            frameCount = 0;
-            lastTime = currentTime;
-            targetFps = ctx.cfg.fps;
+    if (snap.debug) {
+        countDebugFrame(*ctx.state);
+        if (!ctx.state->menuFont) logDebugLines(ctx, snap);
+        else {
+            updateGpuOverlay(ctx, snap);
+            float y = 10.0f;
+            for (SDL_Texture* line : ctx.state->gpuOverlayLines) {
+                float w, h;
+                SDL_GetTextureSize(line, &w, &h);
+                SDL_FRect dst{10.0f, y, w, h};
+                SDL_RenderTexture(ctx.ren, line, nullptr, &dst);
+                y += h;
+            }
         }
+    }
+    else if (!ctx.state->gpuOverlayLines.empty()) {
+        clearGpuOverlay(*ctx.state);
+    }
+    {
+        ScopedStageTimer timer(&ctx.state->stages, Stage::Present);
+        SDL_RenderPresent(ctx.ren);
+    }
+    notePresented(ctx, snap, frameIndex);
+}
 
-        char fpsText[32];
-        snprintf(fpsText, sizeof(fpsText), "%d/%d", displayedFps, targetFps);
-
-        if (ctx.state->menuFont) {
-            SDL_Color color = {255, 50, 50, 255};
-            SDL_Surface* surf = TTF_RenderText_Solid(ctx.state->menuFont, fpsText, 8, color);
-            if (surf) {
-                SDL_Texture* tex = SDL_CreateTextureFromSurface(ctx.ren, surf);
-                if (tex) {
-                    SDL_FRect dst{10.0f, 10.0f, static_cast<float>(surf->w), static_cast<float>(surf->h)};
-                    SDL_RenderTexture(ctx.ren, tex, nullptr, &dst);
-                    SDL_DestroyTexture(tex);
-                }
-                SDL_DestroySurface(surf);
-            }
+// Листы нормализуются при загрузке; это страховка на случай, если формат окна сменился
+static bool ensureSpriteFormat(SpriteList& sp, SDL_PixelFormat format) {
+    if (sp.surface->format == format) return true;
+    for (int mip = 0; mip < spriteMipLevels(sp); ++mip) {
+        SDL_Surface*& level = mip == 0 ? sp.surface : sp.mips[mip - 1];
+        SDL_Surface* converted = SDL_ConvertSurface(level, format);
+        if (!converted) {
+            std::cerr << "Failed to convert sprite " << sp.name << ": " << SDL_GetError() << '\n';
+            return false;
         }
+        SDL_DestroySurface(level);
+        level = converted;
     }
-    SDL_RenderPresent(ctx.ren);
+    return true;
+}
 
+// 64x64 пикселя по 4 байта = 16 КБ, тайл целиком помещается в L1/L2
+constexpr int RENDER_TILE_SIZE = 64;
+// Насколько позиция может отличаться от целой, чтобы рисовать без фильтрации
+constexpr float INTEGER_SCALE_EPS = 1.0f / 64.0f;
+
+// Добавляет тайлы региона в конец tiles
+static void buildRenderTiles(const SDL_Rect& region, std::vector<SDL_Rect>& tiles) {
+    for (int ty = region.y; ty < region.y + region.h; ty += RENDER_TILE_SIZE) {
+        int th = std::min(RENDER_TILE_SIZE, region.y + region.h - ty);
+        for (int tx = region.x; tx < region.x + region.w; tx += RENDER_TILE_SIZE) {
+            int tw = std::min(RENDER_TILE_SIZE, region.x + region.w - tx);
+            tiles.push_back({ tx, ty, tw, th });
+        }
+    }
 }
 
-using Fixed = int32_t;
-constexpr int FP_SHIFT = 16;
-constexpr Fixed FP_ONE = 1 << FP_SHIFT;
+/**
+ * @brief SpriteRaster Всё, что нужно для растеризации спрайта в одном кадре
+ *
+ * Координаты назначения - в системе целевого буфера (окно или блок кэша кадров).
+ * rect - пиксели, которые покрывает спрайт, без отсечения по буферу.
+ */
+struct SpriteRaster {
+    const Uint32* srcPixels = nullptr;
+    int srcPitch = 0;
+    int srcX = 0, srcY = 0, srcW = 0, srcH = 0;
+    float dstX = 0.0f, dstY = 0.0f, dstW = 0.0f, dstH = 0.0f;
+    const BlendKernels* kernels = nullptr;
+    CpuFilter filter = CpuFilter::Bilinear;
+    Uint32 opaqueMask = 0;
+    int alphaByte = 3;
+    bool integerScale = false;
+    int intScale = 1;
+    SDL_Rect rect{ 0, 0, 0, 0 };
+    const ResampleTable* cols = nullptr; // только для двухпроходных фильтров
+    const ResampleTable* rows = nullptr;
+    const AlphaSpanIndex* spans = nullptr; // отрезки альфы уровня; nullptr - смешивать всё подряд
+};
 
-inline Fixed toFixed(float v) {
-    return static_cast<Fixed>(v * FP_ONE + (v >= 0 ? 0.5f : -0.5f));
+static SpriteRaster makeSpriteRaster(const SDL_Surface* level, const RenderGeometry& geom,
+                                     const BlendKernels& kernels, CpuFilter filter, Uint32 opaqueMask) {
+    SpriteRaster r;
+    r.srcPixels = static_cast<const Uint32*>(level->pixels);
+    r.srcPitch = level->pitch / static_cast<int>(sizeof(Uint32));
+    r.srcX = geom.srcX;
+    r.srcY = geom.srcY;
+    r.srcW = geom.srcW;
+    r.srcH = geom.srcH;
+    r.dstX = geom.dstX;
+    r.dstY = geom.dstY;
+    r.dstW = geom.dstW;
+    r.dstH = geom.dstH;
+    r.kernels = &kernels;
+    r.filter = filter;
+    r.opaqueMask = opaqueMask;
+    while (r.alphaByte > 0 && (opaqueMask >> (r.alphaByte * 8)) == 0) --r.alphaByte;
+
+    // Целый масштаб (или почти 1:1) без дробного сдвига: строки источника идут в кадр
+    // напрямую, без пересчёта координат на каждый пиксель
+    r.intScale = std::max(1, static_cast<int>(std::lround(r.dstW / r.srcW)));
+    const float snapX = std::round(r.dstX);
+    const float snapY = std::round(r.dstY);
+    r.integerScale =
+        std::fabs(r.dstW - static_cast<float>(r.intScale * r.srcW)) < 1.0f &&
+        std::fabs(r.dstH - static_cast<float>(r.intScale * r.srcH)) < 1.0f &&
+        std::fabs(r.dstX - snapX) < INTEGER_SCALE_EPS &&
+        std::fabs(r.dstY - snapY) < INTEGER_SCALE_EPS;
+
+    if (r.integerScale) {
+        r.rect = { static_cast<int>(snapX), static_cast<int>(snapY), r.intScale * r.srcW, r.intScale * r.srcH };
+    }
+    else {
+        // Пиксели, чьи центры попадают внутрь прямоугольника спрайта
+        int left = static_cast<int>(std::ceil(r.dstX - 0.5f));
+        int top = static_cast<int>(std::ceil(r.dstY - 0.5f));
+        int right = static_cast<int>(std::ceil(r.dstX + r.dstW - 0.5f));
+        int bottom = static_cast<int>(std::ceil(r.dstY + r.dstH - 0.5f));
+        r.rect = { left, top, std::max(0, right - left), std::max(0, bottom - top) };
+    }
+    return r;
 }
 
-inline float toFloat(Fixed v) {
-    return static_cast<float>(v) / FP_ONE;
+static bool isSeparableFilter(CpuFilter f) {
+    return f == CpuFilter::Triangle || f == CpuFilter::Bicubic || f == CpuFilter::Lanczos;
 }
 
-static Uint32 sampleBilinear(SDL_Surface* src, float u, float v) {
-    if (!src) return 0;
+// Таблицы строятся на всю область спрайта один раз; тайлы берут из них свои отрезки
+static void attachResampleTables(SpriteRaster& r, ResampleTable& cols, ResampleTable& rows) {
+    if (!isSeparableFilter(r.filter) || r.integerScale || r.rect.w <= 0 || r.rect.h <= 0) return;
 
-    const SDL_PixelFormatDetails* fmtDetails = SDL_GetPixelFormatDetails(src->format);
-    if (!fmtDetails) return 0;
+    ResampleKernel kernel = ResampleKernel::Lanczos3;
+    if (r.filter == CpuFilter::Triangle) kernel = ResampleKernel::Triangle;
+    else if (r.filter == CpuFilter::Bicubic) kernel = ResampleKernel::Bicubic;
 
-    int x0 = static_cast<int>(std::floor(u));
-    int y0 = static_cast<int>(std::floor(v));
-    int x1 = x0 + 1;
-    int y1 = y0 + 1;
+    buildResampleTable(cols, kernel, r.srcX, r.srcX + r.srcW - 1, r.rect.x, r.rect.w, r.dstX, r.srcW / r.dstW);
+    buildResampleTable(rows, kernel, r.srcY, r.srcY + r.srcH - 1, r.rect.y, r.rect.h, r.dstY, r.srcH / r.dstH);
+    r.cols = &cols;
+    r.rows = &rows;
+}
 
-    x0 = std::clamp(x0, 0, src->w - 1);
-    x1 = std::clamp(x1, 0, src->w - 1);
-    y0 = std::clamp(y0, 0, src->h - 1);
-    y1 = std::clamp(y1, 0, src->h - 1);
+// Рисует часть спрайта part (внутри r.rect) в target, где target[y * stride + x] - пиксель (x, y)
+static void rasterizeSprite(const SpriteRaster& r, const SDL_Rect& part, Uint32* target, int stride) {
+    const BlendKernels& kernels = *r.kernels;
+
+    if (r.integerScale) {
+        const int k = r.intScale;
+        const int xEnd = part.x + part.w;
+        for (int y = part.y; y < part.y + part.h; ++y) {
+            const int sy = r.srcY + (y - r.rect.y) / k;
+            const Uint32* srcRow = r.srcPixels + sy * r.srcPitch + r.srcX;
+            Uint32* dstRow = target + y * stride;
+            // Без индекса вся строка - один отрезок со смешиванием
+            const AlphaRun whole{ r.srcX + r.srcW, AlphaRunKind::Partial };
+            const AlphaRun* run = r.spans ? r.spans->find(sy, r.srcX + (part.x - r.rect.x) / k) : &whole;
+            for (int x = part.x; x < xEnd; ++run) {
+                const int runEnd = std::min(xEnd, r.rect.x + (run->end - r.srcX) * k);
+                const int dx = x - r.rect.x;
+                const int n = runEnd - x;
+                if (run->kind == AlphaRunKind::Opaque) {
+                    if (k == 1) std::memcpy(dstRow + x, srcRow + dx, static_cast<size_t>(n) * sizeof(Uint32));
+                    else copyRowRepeat(dstRow + x, srcRow + dx / k, n, k, dx % k);
+                }
+                else if (run->kind == AlphaRunKind::Partial) {
+                    if (k == 1) kernels.row(dstRow + x, srcRow + dx, n, r.opaqueMask);
+                    else kernels.rowRepeat(dstRow + x, srcRow + dx / k, n, k, dx % k, r.opaqueMask);
+                }
+                x = runEnd;
+            }
+        }
+        return;
+    }
 
-    float fx = u - x0;
-    float fy = v - y0;
+    if (r.cols) {
+        ResampleJob job;
+        job.pixels = r.srcPixels;
+        job.pitch = r.srcPitch;
+        job.cols = r.cols;
+        job.rows = r.rows;
+        job.colOffset = part.x - r.rect.x;
+        job.rowOffset = part.y - r.rect.y;
+        job.w = part.w;
+        job.h = part.h;
+        job.alphaByte = r.alphaByte;
+        resampleSeparable(job, [&](int y, const Uint32* row) {
+            kernels.row(target + (part.y + y) * stride + part.x, row, part.w, r.opaqueMask);
+        });
+        return;
+    }
 
-    auto getPixel = [&](int x, int y) -> Uint32 {
-        return static_cast<Uint32*>(src->pixels)[y * src->w + x];
+    const float scaleX = r.srcW / r.dstW;
+    const float scaleY = r.srcH / r.dstH;
+
+    if (r.filter == CpuFilter::Box) {
+        BoxSpan box;
+        box.pixels = r.srcPixels;
+        box.pitch = r.srcPitch;
+        box.u = toFixed(r.srcX + (part.x - r.dstX) * scaleX);
+        box.du = toFixed(scaleX);
+        box.dv = toFixed(scaleY);
+        box.minX = r.srcX;
+        box.maxX = r.srcX + r.srcW - 1;
+        box.minY = r.srcY;
+        box.maxY = r.srcY + r.srcH - 1;
+        box.alphaMask = r.opaqueMask;
+        for (int y = part.y; y < part.y + part.h; ++y) {
+            box.v = toFixed(r.srcY + (y - r.dstY) * scaleY);
+            kernels.box(target + y * stride + part.x, part.w, box);
+        }
+        return;
+    }
+
+    BilinearSpan span;
+    span.du = toFixed(scaleX);
+    span.minX = r.srcX;
+    span.maxX = r.srcX + r.srcW - 1;
+    span.alphaMask = r.opaqueMask;
+
+    // Строка смешивается кусками между пикселями, которые читают только прозрачные столбцы
+    const int taps = r.filter == CpuFilter::Nearest ? 1 : 2;
+    const BlendSpanFn blend = r.filter == CpuFilter::Nearest ? kernels.nearest : kernels.bilinear;
+    auto blendRow = [&](Uint32* dst, int sy0, int sy1) {
+        if (!r.spans) {
+            blend(dst, part.w, span);
+            return;
+        }
+        const Fixed u = span.u;
+        int done = 0;
+        auto flush = [&](int upTo) {
+            if (upTo <= done) return;
+            span.u = u + span.du * done;
+            blend(dst + done, upTo - done, span);
         };
+        forEachTransparentRun(*r.spans, sy0, sy1, span.minX, span.maxX, [&](int a, int b) {
+            int first, last;
+            transparentDestRange(u, span.du, part.w, a, b, span.minX, span.maxX, taps, first, last);
+            if (first >= last) return;
+            flush(first);
+            done = std::max(done, last);
+        });
+        flush(part.w);
+        span.u = u;
+    };
+
+    if (r.filter == CpuFilter::Nearest) {
+        span.u = toFixed(r.srcX + (part.x + 0.5f - r.dstX) * scaleX);
+        for (int y = part.y; y < part.y + part.h; ++y) {
+            int sy = static_cast<int>(std::floor(r.srcY + (y + 0.5f - r.dstY) * scaleY));
+            sy = std::clamp(sy, r.srcY, r.srcY + r.srcH - 1);
+            span.row0 = r.srcPixels + sy * r.srcPitch;
+            blendRow(target + y * stride + part.x, sy, sy);
+        }
+        return;
+    }
 
-    Uint8 r00, g00, b00, a00;
-    Uint8 r10, g10, b10, a10;
-    Uint8 r01, g01, b01, a01;
-    Uint8 r11, g11, b11, a11;
+    span.u = toFixed(r.srcX + (part.x + 0.5f - r.dstX) * scaleX - 0.5f);
+    for (int y = part.y; y < part.y + part.h; ++y) {
+        Fixed v = toFixed(r.srcY + (y + 0.5f - r.dstY) * scaleY - 0.5f);
+        int y0 = v >> FP_SHIFT;
+        const int sy0 = std::clamp(y0, r.srcY, r.srcY + r.srcH - 1);
+        const int sy1 = std::clamp(y0 + 1, r.srcY, r.srcY + r.srcH - 1);
+        span.row0 = r.srcPixels + sy0 * r.srcPitch;
+        span.row1 = r.srcPixels + sy1 * r.srcPitch;
+        span.fy = (static_cast<Uint32>(v) >> 8) & 0xFF;
+        blendRow(target + y * stride + part.x, sy0, sy1);
+    }
+}
 
-    SDL_GetRGBA(getPixel(x0, y0), fmtDetails, nullptr, &r00, &g00, &b00, &a00);
-    SDL_GetRGBA(getPixel(x1, y0), fmtDetails, nullptr, &r10, &g10, &b10, &a10);
-    SDL_GetRGBA(getPixel(x0, y1), fmtDetails, nullptr, &r01, &g01, &b01, &a01);
-    SDL_GetRGBA(getPixel(x1, y1), fmtDetails, nullptr, &r11, &g11, &b11, &a11);
+// Видимая часть блока спрайта вместе с фоном: visible - пересечение спрайта с окном,
+// origin - левый верхний угол спрайта в окне. Буфер берётся из вытесненных записей
+static const CpuFrameBlock* acquireCpuFrameBlock(AppContext& ctx, const RenderGeometry& geom, int frameIndex,
+                                                 const SDL_Rect& visible, int originX, int originY,
+                                                 CpuFilter filter, const SDL_Surface* level, const AlphaSpanIndex* spans,
+                                                 const BlendKernels& kernels,
+                                                 Uint32 opaqueMask, Uint32 bg) {
+    const int w = visible.w;
+    const int h = visible.h;
+    FrameKey key{ ctx.state->currentSpriteIndex, frameIndex, geom.mip,
+                  static_cast<int>(geom.dstW), static_cast<int>(geom.dstH), static_cast<int>(filter),
+                  visible.x - originX, visible.y - originY, w, h };
+    if (const CpuFrameBlock* hit = ctx.cpuFrameCache->find(key)) return hit;
+
+    CpuFrameBlock block;
+    block.w = w;
+    block.h = h;
+    block.pixels.swap(ctx.state->cpuBlockSpare);
+    block.pixels.assign(static_cast<size_t>(w) * h, bg);
+
+    // Начало координат - угол видимой части, всё за окном растеризатор отсекает сам
+    RenderGeometry local = geom;
+    local.dstX = geom.dstX - static_cast<float>(visible.x);
+    local.dstY = geom.dstY - static_cast<float>(visible.y);
+    SpriteRaster raster = makeSpriteRaster(level, local, kernels, filter, opaqueMask);
+    raster.spans = spans;
+    attachResampleTables(raster, ctx.state->resampleCols, ctx.state->resampleRows);
+
+    SDL_Rect whole{ 0, 0, w, h };
+    SDL_Rect part;
+    std::vector<SDL_Rect>& tiles = ctx.state->renderTiles;
+    tiles.clear();
+    if (SDL_GetRectIntersection(&raster.rect, &whole, &part)) {
+        buildRenderTiles(part, tiles);
+    }
+    Uint32* pixels = block.pixels.data();
+    ctx.pool->run(tiles.size(), [&](size_t t) {
+        rasterizeSprite(raster, tiles[t], pixels, w);
+    });
 
-    auto lerpUint8 = [&](Uint8 a, Uint8 b, float t) -> Uint8 {
-        return static_cast<Uint8>(a + t * (b - a) + 0.5f);
-        };
+    size_t bytes = block.pixels.size() * sizeof(Uint32);
+    return &ctx.cpuFrameCache->insert(key, std::move(block), bytes);
+}
 
-    Uint8 r_top = lerpUint8(r00, r10, fx);
-    Uint8 g_top = lerpUint8(g00, g10, fx);
-    Uint8 b_top = lerpUint8(b00, b10, fx);
-    Uint8 a_top = lerpUint8(a00, a10, fx);
+// Пиксели вытесненных блоков возвращаются в оборот: промах в установившемся режиме не выделяет память
+static FrameCache<CpuFrameBlock>* createCpuFrameCache(AppContext& ctx, int budgetMB) {
+    if (budgetMB <= 0) return nullptr;
+    MainLoopState* st = ctx.state;
+    return new FrameCache<CpuFrameBlock>(static_cast<size_t>(budgetMB) << 20, [st](CpuFrameBlock& block) {
+        if (block.pixels.capacity() > st->cpuBlockSpare.capacity()) st->cpuBlockSpare.swap(block.pixels);
+    });
+}
+
+static void logFrameCacheStats(AppContext& ctx) {
+    static Uint64 lastLog = 0;
+    Uint64 now = SDL_GetTicks();
+    if (now - lastLog < 5000) return;
+    lastLog = now;
+
+    auto report = [](const char* name, auto* cache) {
+        if (!cache) return;
+        std::cout << "[frame cache " << name << "] hit rate " << cache->hitRate() * 100.0 << "% ("
+                  << cache->hits() << "/" << (cache->hits() + cache->misses()) << "), "
+                  << cache->entries() << " frames, " << cache->bytes() / (1024.0 * 1024.0) << " MB\n";
+    };
+    report("cpu", ctx.cpuFrameCache);
+}
+
+static void clearCpuOverlay(MainLoopState& st) {
+    for (SDL_Surface* line : st.cpuOverlayLines) SDL_DestroySurface(line);
+    st.cpuOverlayLines.clear();
+    st.cpuOverlayRect = { 0, 0, 0, 0 };
+}
+
+// Пересобирает отладочный текст, если пришло новое окно сводки этапов или fps; true - текст
+// сменился и его место надо перерисовать
+static bool updateCpuOverlay(AppContext& ctx, const RenderSnapshot& snap) {
+    MainLoopState& st = *ctx.state;
+    if (!snap.debug || !st.menuFont || ctx.cfg.headless) {
+        const bool had = !st.cpuOverlayLines.empty();
+        clearCpuOverlay(st);
+        return had;
+    }
+    if (snap.stageWindow == st.cpuOverlayWindow && st.debugFpsWindow == st.cpuOverlayFpsWindow
+        && !st.cpuOverlayLines.empty()) return false;
+    clearCpuOverlay(st);
+    st.cpuOverlayWindow = snap.stageWindow;
+    st.cpuOverlayFpsWindow = st.debugFpsWindow;
+
+    char lines[DEBUG_LINES][64];
+    const int lineCount = formatDebugLines(ctx, snap, lines, DEBUG_LINES);
+    SDL_Color color = {255, 50, 50, 255};
+    int y = 10;
+    for (int i = 0; i < lineCount; ++i) {
+        SDL_Surface* surf = TTF_RenderText_Solid(st.menuFont, lines[i], strlen(lines[i]), color);
+        if (!surf) continue;
+        SDL_Rect rect{ 10, y, surf->w, surf->h };
+        SDL_GetRectUnion(&st.cpuOverlayRect, &rect, &st.cpuOverlayRect);
+        st.cpuOverlayLines.push_back(surf);
+        y += surf->h;
+    }
+    return true;
+}
 
-    Uint8 r_bot = lerpUint8(r01, r11, fx);
-    Uint8 g_bot = lerpUint8(g01, g11, fx);
-    Uint8 b_bot = lerpUint8(b01, b11, fx);
-    Uint8 a_bot = lerpUint8(a01, a11, fx);
+static SDL_Rect cpuContextMenuRect(const RenderSnapshot& snap, int winW, int winH) {
+    if (!snap.showContextMenu) return { 0, 0, 0, 0 };
+    const int menuW = 150;
+    const int menuH = 80;
+    int menuX = std::clamp(snap.contextMenuX, 0, std::max(0, winW - menuW));
+    int menuY = std::clamp(snap.contextMenuY, 0, std::max(0, winH - menuH));
+    SDL_Rect menu{ menuX, menuY, std::min(menuW, winW), std::min(menuH, winH) };
+    return menu;
+}
 
-    Uint8 r = lerpUint8(r_top, r_bot, fy);
-    Uint8 g = lerpUint8(g_top, g_bot, fy);
-    Uint8 b = lerpUint8(b_top, b_bot, fy);
-    Uint8 a = lerpUint8(a_top, a_bot, fy);
+static void drawCpuContextMenu(Uint32* frame, int stride, const SDL_Rect& menu, const SDL_PixelFormatDetails* fmt, Uint32 opaqueMask) {
+    Uint32 menuBg = SDL_MapRGB(fmt, nullptr, 40, 40, 40) | opaqueMask;
+    Uint32 menuBorder = SDL_MapRGB(fmt, nullptr, 200, 200, 200) | opaqueMask;
 
-    return SDL_MapRGBA(fmtDetails, nullptr, r, g, b, a);
+    for (int y = menu.y; y < menu.y + menu.h; ++y) {
+        Uint32* row = frame + y * stride;
+        bool edgeRow = (y == menu.y || y == menu.y + menu.h - 1);
+        for (int x = menu.x; x < menu.x + menu.w; ++x) {
+            bool edge = edgeRow || x == menu.x || x == menu.x + menu.w - 1;
+            row[x] = edge ? menuBorder : menuBg;
+        }
+    }
 }
 
-static void renderFrameCpu(AppContext& ctx, int frameIndex) {
-    SDL_Surface* winSurface = SDL_GetWindowSurface(ctx.win);
+// Перерисовываются только объединения старых и новых прямоугольников спрайта, меню и
+// отладочного текста, остальное окно остаётся с прошлого кадра
+static void renderFrameCpu(AppContext& ctx, const RenderSnapshot& snap, int frameIndex) {
+    MainLoopState& st = *ctx.state;
+
+    // Поверхность окна запрашивается заново только после изменения размера (см. handleEvents)
+    if (!ctx.winSurface && !ctx.cfg.headless) {
+        ctx.winSurface = SDL_GetWindowSurface(ctx.win);
+        st.cpuFullRedraw = true;
+    }
+    SDL_Surface* winSurface = ctx.winSurface;
     if (!winSurface) return;
 
     SpriteList& sp = ctx.sprites[ctx.state->currentSpriteIndex];
@@ -424,127 +1049,168 @@ static void renderFrameCpu(AppContext& ctx, int frameIndex) {
     RenderGeometry geom = computeRenderGeometry(
         sp.surface->w, sp.surface->h,
         winW, winH,
-        ctx, frameIndex,
-        ctx.cfg.shakingAmp,
-        ctx.cfg.shakingFreq,
+        snap, frameIndex,
+        snap.shakingAmp,
+        snap.shakingFreq,
         sp.baseOffsetX,
-        sp.baseOffsetY
+        sp.baseOffsetY,
+        spriteMipLevels(sp),
+        sp.cols, sp.rows,
+        ctx.cpuFrameCache ? BREATH_CACHE_STEP : 0.0f
     );
 
-    float dstX = geom.dstX;
-    float dstY = geom.dstY;
-    float dstW = geom.dstW;
-    float dstH = geom.dstH;
-    int srcX = geom.srcX;
-    int srcY = geom.srcY;
-    int srcW = geom.srcW;
-    int srcH = geom.srcH;
-
-    if (dstW <= 0 || dstH <= 0 || srcW <= 0 || srcH <= 0) return;
+    // Спрайт схлопнулся - рисовать нечего, но прежнее место надо стереть, а prevSpriteRect обновить
+    const bool spriteVisible = geom.dstW > 0 && geom.dstH > 0 && geom.srcW > 0 && geom.srcH > 0;
 
     const SDL_PixelFormatDetails* dstFmt = SDL_GetPixelFormatDetails(winSurface->format);
     if (!dstFmt) return;
 
-    Uint8 bgR = (ctx.cfg.bgColor >> 16) & 0xFF;
-    Uint8 bgG = (ctx.cfg.bgColor >> 8) & 0xFF;
-    Uint8 bgB = ctx.cfg.bgColor & 0xFF;
-    Uint32 bg = SDL_MapRGB(dstFmt, nullptr, bgR, bgG, bgB);
-
-    std::vector<Uint32> frameBuffer(winW * winH, bg);
-
-    float invDstW = 1.0f / dstW;
-    float invDstH = 1.0f / dstH;
-
+    if (!ensureSpriteFormat(sp, spriteFormatFor(winSurface->format))) return;
     const SDL_PixelFormatDetails* srcFmt = SDL_GetPixelFormatDetails(sp.surface->format);
     if (!srcFmt) return;
 
-    int dstLeft = std::max(0, static_cast<int>(std::floor(dstX)));
-    int dstTop = std::max(0, static_cast<int>(std::floor(dstY)));
-    int dstRight = std::min(winW, static_cast<int>(std::ceil(dstX + dstW)));
-    int dstBottom = std::min(winH, static_cast<int>(std::ceil(dstY + dstH)));
-
-    if (dstLeft >= dstRight || dstTop >= dstBottom) return;
-
-    const int height = dstBottom - dstTop;
-    const int rowsPerThread = std::max(1, height / static_cast<int>(ctx.nThreads)); 
-    std::vector<std::thread> workers;
-
-    for (int t = 0; t < static_cast<int>(ctx.nThreads); ++t) {
-        const int yStart = dstTop + t * rowsPerThread;
-        const int yEnd = (t == static_cast<int>(ctx.nThreads) - 1) ? dstBottom : std::min(yStart + rowsPerThread, dstBottom);
-
-        if (yStart >= yEnd) continue;
-
-        workers.emplace_back([&, yStart, yEnd]() {
-            for (int y = yStart; y < yEnd; ++y) {
-                for (int x = dstLeft; x < dstRight; ++x) {
-                    float fx = (x + 0.5f - dstX) * invDstW;
-                    float fy = (y + 0.5f - dstY) * invDstH;
-                    if (fx < 0.0f || fx >= 1.0f || fy < 0.0f || fy >= 1.0f) continue;
-
-                    float srcU = srcX + fx * srcW;
-                    float srcV = srcY + fy * srcH;
-
-                    Uint32 srcPixel = sampleBilinear(sp.surface, srcU, srcV);
-
-                    Uint8 sr, sg, sb, sa;
-                    SDL_GetRGBA(srcPixel, srcFmt, nullptr, &sr, &sg, &sb, &sa);
+    const Uint32 opaqueMask = static_cast<Uint32>(0xFF) << srcFmt->Ashift;
+
+    Uint8 bgR = (snap.bgColor >> 16) & 0xFF;
+    Uint8 bgG = (snap.bgColor >> 8) & 0xFF;
+    Uint8 bgB = snap.bgColor & 0xFF;
+    Uint32 bg = SDL_MapRGB(dstFmt, nullptr, bgR, bgG, bgB) | opaqueMask;
+
+    const SDL_Surface* level = spriteMipSurface(sp, geom.mip);
+    const AlphaSpanIndex* spans = geom.mip < static_cast<int>(sp.alphaSpans.size()) ? &sp.alphaSpans[geom.mip] : nullptr;
+    const BlendKernels& kernels = selectBlendKernels(srcFmt->Ashift);
+
+    SDL_Rect window{ 0, 0, winW, winH };
+    SDL_Rect spriteRect{ 0, 0, 0, 0 };
+    SpriteRaster raster;
+    const CpuFrameBlock* block = nullptr;
+    if (spriteVisible) {
+        if (ctx.cpuFrameCache) snapGeometryForCache(geom);
+        raster = makeSpriteRaster(level, geom, kernels, snap.cpuFilter, opaqueMask);
+        raster.spans = spans;
+        if (!SDL_GetRectIntersection(&raster.rect, &window, &spriteRect)) spriteRect = { 0, 0, 0, 0 };
+
+        if (ctx.cpuFrameCache && !SDL_RectEmpty(&spriteRect)) {
+            block = acquireCpuFrameBlock(ctx, geom, frameIndex, spriteRect, raster.rect.x, raster.rect.y,
+                                         snap.cpuFilter, level, spans, kernels, opaqueMask, bg);
+        }
+        if (!block && !SDL_RectEmpty(&spriteRect)) attachResampleTables(raster, st.resampleCols, st.resampleRows);
+    }
+    SDL_Rect menuRect = cpuContextMenuRect(snap, winW, winH);
+    const SDL_Rect prevOverlayRect = st.cpuOverlayRect;
+    if (snap.debug) countDebugFrame(st);
+    const bool overlayChanged = updateCpuOverlay(ctx, snap);
+
+    SDL_Rect dirty[3];
+    int dirtyCount = 0;
+    if (st.cpuFullRedraw) {
+        dirty[dirtyCount++] = { 0, 0, winW, winH };
+        st.cpuFullRedraw = false;
+    }
+    else {
+        // Текст перерисовывается поверх каждого кадра, а его место чистится только при смене
+        SDL_Rect parts[3] = {};
+        SDL_GetRectUnion(&st.prevSpriteRect, &spriteRect, &parts[0]);
+        SDL_GetRectUnion(&st.prevMenuRect, &menuRect, &parts[1]);
+        if (overlayChanged) SDL_GetRectUnion(&prevOverlayRect, &st.cpuOverlayRect, &parts[2]);
+        // Тайлы разных прямоугольников не должны пересекаться, иначе потоки подерутся за пиксели
+        for (const SDL_Rect& part : parts) {
+            SDL_Rect merged;
+            if (!SDL_GetRectIntersection(&part, &window, &merged)) continue;
+            // После слияния прямоугольник мог задеть уже пропущенный - тогда проход заново
+            for (int i = 0; i < dirtyCount;) {
+                if (SDL_HasRectIntersection(&merged, &dirty[i])) {
+                    SDL_GetRectUnion(&merged, &dirty[i], &merged);
+                    dirty[i] = dirty[--dirtyCount];
+                    i = 0;
+                }
+                else {
+                    ++i;
+                }
+            }
+            dirty[dirtyCount++] = merged;
+        }
+    }
+    st.prevSpriteRect = spriteRect;
+    st.prevMenuRect = menuRect;
+    if (dirtyCount == 0) return;
 
-                    if (sa == 0) continue;
+    if (SDL_MUSTLOCK(winSurface) && !SDL_LockSurface(winSurface)) {
+        st.cpuFullRedraw = true;
+        return;
+    }
+    // Строки поверхности могут быть выровнены с запасом, поэтому шаг берётся из pitch
+    Uint32* frame = static_cast<Uint32*>(winSurface->pixels);
+    const int stride = winSurface->pitch / static_cast<int>(sizeof(Uint32));
+
+    std::vector<SDL_Rect>& tiles = st.renderTiles;
+    tiles.clear();
+    for (int i = 0; i < dirtyCount; ++i) {
+        buildRenderTiles(dirty[i], tiles);
+    }
 
-                    Uint32 dstPixel = frameBuffer[y * winW + x];
-                    Uint8 dr, dg, db, da;
-                    SDL_GetRGBA(dstPixel, dstFmt, nullptr, &dr, &dg, &db, &da);
+    {
+        ScopedStageTimer timer(&st.stages, Stage::Raster);
+        ctx.pool->run(tiles.size(), [&](size_t t) {
+            const SDL_Rect& tile = tiles[t];
+            for (int y = tile.y; y < tile.y + tile.h; ++y) {
+                std::fill_n(frame + y * stride + tile.x, tile.w, bg);
+            }
 
-                    float a = sa / 255.0f;
-                    Uint8 r = static_cast<Uint8>(sr * a + dr * (1.0f - a) + 0.5f);
-                    Uint8 g = static_cast<Uint8>(sg * a + dg * (1.0f - a) + 0.5f);
-                    Uint8 b = static_cast<Uint8>(sb * a + db * (1.0f - a) + 0.5f);
+            SDL_Rect part;
+            if (!SDL_GetRectIntersection(&tile, &spriteRect, &part)) return;
 
-                    frameBuffer[y * winW + x] = SDL_MapRGB(dstFmt, nullptr, r, g, b);
+            if (block) {
+                for (int y = part.y; y < part.y + part.h; ++y) {
+                    const Uint32* src = block->pixels.data() + (y - spriteRect.y) * block->w + (part.x - spriteRect.x);
+                    std::memcpy(frame + y * stride + part.x, src, part.w * sizeof(Uint32));
                 }
+                return;
             }
-            });
-    }
+            rasterizeSprite(raster, part, frame, stride);
+        });
 
-    for (auto& th : workers) {
-        th.join();
+        if (!SDL_RectEmpty(&menuRect)) {
+            drawCpuContextMenu(frame, stride, menuRect, dstFmt, opaqueMask);
+        }
     }
 
-    if (ctx.state->showContextMenu) {
-        int menuX = ctx.state->contextMenuX;
-        int menuY = ctx.state->contextMenuY;
-        int menuW = 150;
-        int menuH = 80;
-
-        menuX = std::clamp(menuX, 0, winW - menuW);
-        menuY = std::clamp(menuY, 0, winH - menuH);
+    if (SDL_MUSTLOCK(winSurface)) SDL_UnlockSurface(winSurface);
 
-        Uint32 menuBg = SDL_MapRGB(dstFmt, nullptr, 40, 40, 40);
-        Uint32 menuBorder = SDL_MapRGB(dstFmt, nullptr, 200, 200, 200);
+    int lineY = 10;
+    for (SDL_Surface* line : st.cpuOverlayLines) {
+        SDL_Rect dst{ 10, lineY, line->w, line->h };
+        SDL_BlitSurface(line, nullptr, winSurface, &dst);
+        lineY += line->h;
+    }
 
-        for (int y = menuY; y < menuY + menuH; ++y) {
-            for (int x = menuX; x < menuX + menuW; ++x) {
-                if (y >= 0 && y < winH && x >= 0 && x < winW) {
-                    frameBuffer[y * winW + x] = menuBg;
-                }
+    if (ctx.cfg.headless) {
+        // Кадр целиком лежит в своём буфере в порядке байт RGBA
+        if (streaming(ctx)) {
+            {
+                ScopedStageTimer timer(&st.stages, Stage::Readback);
+                ctx.stream->submit(static_cast<const uint8_t*>(winSurface->pixels), winW, winH, winSurface->pitch);
             }
+            notePresented(ctx, snap, frameIndex);
         }
-
-        for (int x = menuX; x < menuX + menuW && x < winW; ++x) {
-            if (menuY >= 0 && menuY < winH) frameBuffer[menuY * winW + x] = menuBorder;
-            if (menuY + menuH - 1 < winH) frameBuffer[(menuY + menuH - 1) * winW + x] = menuBorder;
+        else {
+            // Стрима нет или он оборвался: кадр никто не видит, и рот, открытый сейчас,
+            // не должен попасть в гистограмму с задержкой до подключения клиента
+            st.shownOnsetNs = snap.speakOnsetNs;
         }
-        for (int y = menuY; y < menuY + menuH && y < winH; ++y) {
-            if (menuX >= 0) frameBuffer[y * winW + menuX] = menuBorder;
-            if (menuX + menuW - 1 < winW) frameBuffer[y * winW + (menuX + menuW - 1)] = menuBorder;
+    }
+    else {
+        {
+            ScopedStageTimer timer(&st.stages, Stage::Present);
+            SDL_UpdateWindowSurfaceRects(ctx.win, dirty, dirtyCount);
         }
+        notePresented(ctx, snap, frameIndex);
     }
 
-    Uint32* dstPixels = static_cast<Uint32*>(winSurface->pixels);
-    std::memcpy(dstPixels, frameBuffer.data(), frameBuffer.size() * sizeof(Uint32));
-
-    SDL_UpdateWindowSurface(ctx.win);
+    if (snap.debug) {
+        logFrameCacheStats(ctx);
+        if (st.cpuOverlayLines.empty()) logDebugLines(ctx, snap);
+    }
 }
 
 void downloadPixelsFromGPUTexture(SDL_GPUTexture* gpu_texture, uint8_t** out_pixels, size_t* out_size, AppContext& ctx) {
@@ -602,15 +1268,13 @@ static int callback_websocket(struct lws* wsi, enum lws_callback_reasons reason,
     case LWS_CALLBACK_CLIENT_ESTABLISHED:
     {
         AppContext* ctx = (AppContext*)lws_context_user(lws_get_context(wsi));
-        ctx->state->wsi = wsi;
-        ctx->state->webDisplaying = true;
+        if (ctx->stream) ctx->stream->setConnection(wsi);
     }
     break;
     case LWS_CALLBACK_CLIENT_CLOSED:
     {
         AppContext* ctx = (AppContext*)lws_context_user(lws_get_context(wsi));
-        ctx->state->wsi = nullptr;
-        ctx->state->webDisplaying = false;
+        if (ctx->stream) ctx->stream->setConnection(nullptr);
     }
     break;
     default:
@@ -0,0 +1,97 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+/**
+ * @brief AtlasFrame Где в атласе лежит один кадр (четверть листа) одного уровня mip
+ *
+ * crop - непрозрачная часть кадра в координатах четверти, rect - то же место на странице атласа.
+ * Пустой кадр (целиком прозрачный) имеет crop нулевого размера и не рисуется.
+ */
+struct AtlasFrame {
+    int page = 0;
+    SDL_Rect rect{ 0, 0, 0, 0 };
+    SDL_Rect crop{ 0, 0, 0, 0 };
+};
+
+// Прямоугольник, который надо положить в атлас (пиксели - в поверхности source)
+struct AtlasItem {
+    const SDL_Surface* source = nullptr;
+    SDL_Rect area{ 0, 0, 0, 0 };
+    AtlasFrame* frame = nullptr; // сюда пишется результат
+};
+
+// Между кусками прозрачный зазор в пиксель, чтобы билинейка не цепляла соседей
+constexpr int ATLAS_GUTTER = 1;
+
+/**
+ * @brief packAtlas Раскладывает куски полками по страницам pageSize x pageSize
+ * @return Поверхности страниц (формат как у источников) или пустой вектор, если кусок не влез в страницу
+ *
+ * Куски сортируются по высоте, полка заполняется слева направо, новая полка - ниже,
+ * новая страница - когда кончилась высота. Страница обрезается по высоте до занятой части.
+ */
+static std::vector<SDL_Surface*> packAtlas(std::vector<AtlasItem>& items, int pageSize, SDL_PixelFormat format) {
+    std::vector<AtlasItem*> order;
+    for (AtlasItem& item : items) {
+        if (item.area.w <= 0 || item.area.h <= 0) continue;
+        if (item.area.w + ATLAS_GUTTER > pageSize || item.area.h + ATLAS_GUTTER > pageSize) return {};
+        order.push_back(&item);
+    }
+    std::stable_sort(order.begin(), order.end(), [](const AtlasItem* a, const AtlasItem* b) {
+        return a->area.h > b->area.h;
+    });
+
+    struct Page { int usedH = 0; };
+    std::vector<Page> pages;
+    int x = ATLAS_GUTTER, y = ATLAS_GUTTER, shelfH = 0;
+    for (AtlasItem* item : order) {
+        const int w = item->area.w, h = item->area.h;
+        if (pages.empty()) pages.emplace_back();
+        if (x + w + ATLAS_GUTTER > pageSize) {
+            x = ATLAS_GUTTER;
+            y += shelfH + ATLAS_GUTTER;
+            shelfH = 0;
+        }
+        if (y + h + ATLAS_GUTTER > pageSize) {
+            pages.emplace_back();
+            x = ATLAS_GUTTER;
+            y = ATLAS_GUTTER;
+            shelfH = 0;
+        }
+        item->frame->page = static_cast<int>(pages.size()) - 1;
+        item->frame->rect = { x, y, w, h };
+        pages.back().usedH = std::max(pages.back().usedH, y + h + ATLAS_GUTTER);
+        x += w + ATLAS_GUTTER;
+        shelfH = std::max(shelfH, h);
+    }
+
+    std::vector<SDL_Surface*> surfaces;
+    for (const Page& page : pages) {
+        SDL_Surface* surf = SDL_CreateSurface(pageSize, page.usedH, format);
+        if (!surf) {
+            for (SDL_Surface* s : surfaces) SDL_DestroySurface(s);
+            return {};
+        }
+        // Новая поверхность уже нулевая - в предумноженной альфе это прозрачный чёрный
+        surfaces.push_back(surf);
+    }
+
+    for (AtlasItem* item : order) {
+        SDL_Surface* page = surfaces[item->frame->page];
+        const SDL_Rect& dst = item->frame->rect;
+        const Uint8* src = static_cast<const Uint8*>(item->source->pixels) +
+                           item->area.y * item->source->pitch + item->area.x * 4;
+        Uint8* out = static_cast<Uint8*>(page->pixels) + dst.y * page->pitch + dst.x * 4;
+        for (int row = 0; row < dst.h; ++row) {
+            std::memcpy(out + row * page->pitch, src + row * item->source->pitch, static_cast<size_t>(dst.w) * 4);
+        }
+    }
+    return surfaces;
+}
+
+#endif // ATLAS_H
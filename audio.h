@@ -0,0 +1,242 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "vad.h"
+#include "viseme.h"
+
+/**
+ * @brief SpscRing Кольцевой буфер на одного писателя и одного читателя без блокировок
+ *
+ * Память выделяется один раз в конструкторе; ёмкость - степень двойки.
+ * Писатель двигает только head_, читатель - только tail_.
+ */
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) {
+        size_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+        data_.resize(cap);
+        mask_ = cap - 1;
+    }
+
+    // Сколько влезло; что не влезло - отбрасывается (читатель не успевает)
+    size_t push(const T* src, size_t count) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        const size_t tail = tail_.load(std::memory_order_acquire);
+        const size_t n = std::min(count, data_.size() - (head - tail));
+        for (size_t i = 0; i < n; ++i) data_[(head + i) & mask_] = src[i];
+        head_.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t pop(T* dst, size_t count) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t head = head_.load(std::memory_order_acquire);
+        const size_t n = std::min(count, head - tail);
+        for (size_t i = 0; i < n; ++i) dst[i] = data_[(tail + i) & mask_];
+        tail_.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> data_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> head_{ 0 };
+    alignas(64) std::atomic<size_t> tail_{ 0 };
+};
+
+/**
+ * @brief AudioCapture Захват микрофона и расчёт громкости вне главного цикла
+ *
+ * Колбэк потока SDL (поток аудио-устройства) только перекладывает сэмплы в кольцо.
+ * Поток анализа режет их на шаги по VadParams::hopMs и прогоняет через VoiceDetector,
+ * а пока слышен голос - раз в VISEME_MS ещё и через VisemeClassifier;
+ * главный цикл читает готовое состояние без блокировок и выделений памяти.
+ */
+class AudioCapture {
+public:
+    static constexpr int SAMPLE_RATE = 8000;
+
+    static constexpr int VISEME_MS = 10;
+
+    AudioCapture() : ring_(SAMPLE_RATE), visemes_(SAMPLE_RATE), history_(VisemeClassifier::FFT_SIZE, 0.0f) {}
+
+    ~AudioCapture() { close(); }
+
+    AudioCapture(const AudioCapture&) = delete;
+    AudioCapture& operator=(const AudioCapture&) = delete;
+
+    bool open(SDL_AudioDeviceID device, const VadParams& params) {
+        hopSamples_ = std::clamp(SAMPLE_RATE * params.hopMs / 1000, 8, 1024);
+        hop_.assign(hopSamples_, 0.0f);
+        vad_.configure(params);
+
+        SDL_AudioSpec spec{};
+        spec.format = SDL_AUDIO_F32;
+        spec.channels = 1;
+        spec.freq = SAMPLE_RATE;
+        stream_ = SDL_OpenAudioDeviceStream(device, &spec, &AudioCapture::onAudio, this);
+        if (!stream_) return false;
+
+        running_.store(true, std::memory_order_relaxed);
+        worker_ = std::thread([this]() { analyze(); });
+        if (!SDL_ResumeAudioStreamDevice(stream_)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (stream_) {
+            SDL_DestroyAudioStream(stream_); // после этого колбэк больше не вызывается
+            stream_ = nullptr;
+        }
+        if (worker_.joinable()) {
+            running_.store(false, std::memory_order_relaxed);
+            wake();
+            worker_.join();
+        }
+    }
+
+    bool active() const { return worker_.joinable(); }
+
+    // Настройки детектора на лету (кроме размера шага)
+    void configure(const VadParams& params) { vad_.configure(params); }
+    // Событие SDL, которое поток анализа кладёт в очередь, когда голос появился или пропал
+    // (будит главный цикл из простоя); 0 - не класть
+    void setWakeEvent(Uint32 type) { wakeEvent_.store(type, std::memory_order_relaxed); }
+    // Без анализа спектра любой голос - Viseme::Open
+    void setVisemes(bool enabled) { visemesEnabled_.store(enabled, std::memory_order_relaxed); }
+
+    bool speaking() const { return vad_.speaking(); }
+    float level() const { return vad_.level(); }
+    float noiseFloor() const { return vad_.noiseFloor(); }
+    // SDL_GetTicksNS захвата звука, включившего детектор; читать после того, как speaking() стал true
+    uint64_t onsetNs() const { return vad_.onsetNs(); }
+    Viseme viseme() const { return viseme_.load(std::memory_order_relaxed); }
+
+    // Сколько сэмплов выброшено, потому что поток анализа не успевал
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    static void SDLCALL onAudio(void* userdata, SDL_AudioStream* stream, int additional, int total) {
+        (void)additional;
+        (void)total;
+        AudioCapture& self = *static_cast<AudioCapture*>(userdata);
+        const Uint64 now = SDL_GetTicksNS();
+        float chunk[512];
+        int got;
+        while ((got = SDL_GetAudioStreamData(stream, chunk, sizeof(chunk))) > 0) {
+            const size_t samples = static_cast<size_t>(got) / sizeof(float);
+            const size_t pushed = self.ring_.push(chunk, samples);
+            self.pushed_ += pushed;
+            if (pushed < samples) self.dropped_.fetch_add(samples - pushed, std::memory_order_relaxed);
+        }
+        // Последний сэмпл пачки пришёл к моменту вызова колбэка
+        const AudioStamp stamp{ self.pushed_, now };
+        self.stamps_.push(&stamp, 1);
+        self.wake();
+    }
+
+    void wake() {
+        pending_.fetch_add(1, std::memory_order_release);
+        pending_.notify_one();
+    }
+
+    void analyze() {
+        const size_t hop = static_cast<size_t>(hopSamples_);
+        const float hopMs = 1000.0f * hopSamples_ / SAMPLE_RATE;
+        const int visemeHop = SAMPLE_RATE * VISEME_MS / 1000;
+        const int historySize = VisemeClassifier::FFT_SIZE;
+        int sinceViseme = 0;
+        bool wasSpeaking = false;
+        uint64_t consumed = 0;
+        AudioStamp stamp;
+        uint32_t seen = pending_.load(std::memory_order_acquire);
+        while (running_.load(std::memory_order_relaxed)) {
+            while (ring_.size() < hop && running_.load(std::memory_order_relaxed)) {
+                pending_.wait(seen, std::memory_order_acquire);
+                seen = pending_.load(std::memory_order_acquire);
+            }
+            while (ring_.size() >= hop) {
+                ring_.pop(hop_.data(), hop);
+                consumed += hop;
+                // Конец шага захвачен раньше конца пачки на столько, сколько сэмплов осталось после него
+                while (stamp.end < consumed && stamps_.pop(&stamp, 1) == 1) {}
+                const uint64_t behind = stamp.end > consumed ? stamp.end - consumed : 0;
+                const uint64_t captureNs = stamp.ns - std::min<uint64_t>(stamp.ns, behind * 1000000000ull / SAMPLE_RATE);
+                vad_.process(hop_.data(), hopSamples_, hopMs, captureNs);
+                if (vad_.speaking() != wasSpeaking) {
+                    wasSpeaking = !wasSpeaking;
+                    pushWakeEvent();
+                }
+
+                // Скользящее окно последних сэмплов для спектра
+                const int keep = std::max(0, historySize - hopSamples_);
+                std::copy(history_.end() - keep, history_.end(), history_.begin());
+                std::copy(hop_.end() - (historySize - keep), hop_.end(), history_.begin() + keep);
+                sinceViseme += hopSamples_;
+                if (!vad_.speaking()) {
+                    if (viseme_.load(std::memory_order_relaxed) != Viseme::Rest) {
+                        visemes_.reset();
+                        viseme_.store(Viseme::Rest, std::memory_order_relaxed);
+                    }
+                    sinceViseme = visemeHop;
+                }
+                else if (!visemesEnabled_.load(std::memory_order_relaxed)) {
+                    viseme_.store(Viseme::Open, std::memory_order_relaxed);
+                }
+                else if (sinceViseme >= visemeHop) {
+                    sinceViseme = 0;
+                    viseme_.store(visemes_.process(history_.data()), std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    void pushWakeEvent() {
+        const Uint32 type = wakeEvent_.load(std::memory_order_relaxed);
+        if (type == 0) return;
+        SDL_Event ev{};
+        ev.type = type;
+        SDL_PushEvent(&ev);
+    }
+
+    struct AudioStamp {
+        uint64_t end = 0; // сколько сэмплов было в кольце всего, включая эту пачку
+        uint64_t ns = 0;
+    };
+
+    SpscRing<float> ring_;
+    SpscRing<AudioStamp> stamps_{ 256 };
+    uint64_t pushed_ = 0; // только для колбэка
+    VoiceDetector vad_;
+    VisemeClassifier visemes_;
+    std::vector<float> history_;
+    int hopSamples_ = 40;
+    std::vector<float> hop_;
+    SDL_AudioStream* stream_ = nullptr;
+    std::thread worker_;
+    std::atomic<bool> running_{ false };
+    std::atomic<uint32_t> pending_{ 0 };
+    std::atomic<uint64_t> dropped_{ 0 };
+    std::atomic<bool> visemesEnabled_{ true };
+    std::atomic<Uint32> wakeEvent_{ 0 };
+    std::atomic<Viseme> viseme_{ Viseme::Rest };
+};
+
+#endif // AUDIO_H
@@ -0,0 +1,146 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief FileWatcher Следит за файлами в папках (inotify) и обрабатывает изменения в своём потоке
+ *
+ * Обработчик вызывается в потоке наблюдателя (там можно декодировать) и возвращает
+ * функцию-завершение; завершения выполняются в потоке, вызвавшем poll() (главном), между кадрами.
+ * Редакторы пишут файл несколькими событиями, поэтому изменения копятся, пока папки
+ * не затихнут на QUIET_MS, и каждый файл обрабатывается один раз.
+ * Вне Linux ничего не делает: active() == false.
+ */
+class FileWatcher {
+public:
+    struct Change {
+        std::string path;
+        bool removed = false;
+    };
+    using Finish = std::function<void()>;
+    using Handler = std::function<Finish(const Change&)>;
+
+    static constexpr int QUIET_MS = 150;
+
+    // ready вызывается в потоке наблюдателя, когда появилось что выполнить в poll()
+    FileWatcher(const std::vector<std::string>& dirs, Handler handler, std::function<void()> ready = nullptr)
+        : handler_(std::move(handler)), ready_(std::move(ready)) {
+#ifdef __linux__
+        fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd_ < 0) return;
+        if (pipe(stopPipe_) != 0) {
+            close(fd_);
+            fd_ = -1;
+            return;
+        }
+        const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+        for (const std::string& dir : dirs) {
+            int wd = inotify_add_watch(fd_, dir.c_str(), mask);
+            if (wd >= 0) dirs_[wd] = dir;
+        }
+        if (dirs_.empty()) {
+            shutdown();
+            return;
+        }
+        worker_ = std::thread([this]() { workerLoop(); });
+#else
+        (void)dirs;
+#endif
+    }
+
+    ~FileWatcher() {
+#ifdef __linux__
+        if (worker_.joinable()) {
+            const char stop = 1;
+            (void)!write(stopPipe_[1], &stop, 1);
+            worker_.join();
+        }
+        shutdown();
+#endif
+    }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    bool active() const { return worker_.joinable(); }
+
+    // Выполняет завершения обработанных изменений
+    void poll() {
+        std::vector<Finish> done;
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            done.swap(done_);
+        }
+        for (Finish& f : done) {
+            if (f) f();
+        }
+    }
+
+private:
+#ifdef __linux__
+    void shutdown() {
+        if (fd_ >= 0) close(fd_);
+        if (stopPipe_[0] >= 0) close(stopPipe_[0]);
+        if (stopPipe_[1] >= 0) close(stopPipe_[1]);
+        fd_ = stopPipe_[0] = stopPipe_[1] = -1;
+    }
+
+    void workerLoop() {
+        // Последнее событие по каждому файлу: удаление после записи - удаление, и наоборот
+        std::map<std::string, bool> pending;
+        alignas(inotify_event) char buf[4096];
+        for (;;) {
+            pollfd fds[2] = { { fd_, POLLIN, 0 }, { stopPipe_[0], POLLIN, 0 } };
+            const int ready = ::poll(fds, 2, pending.empty() ? -1 : QUIET_MS);
+            if (ready < 0) continue;
+            if (fds[1].revents) return;
+
+            if (ready == 0) {
+                for (const auto& [path, removed] : pending) {
+                    Finish finish = handler_({ path, removed });
+                    std::lock_guard<std::mutex> lk(mutex_);
+                    done_.push_back(std::move(finish));
+                }
+                pending.clear();
+                if (ready_) ready_();
+                continue;
+            }
+
+            ssize_t len;
+            while ((len = read(fd_, buf, sizeof(buf))) > 0) {
+                for (char* p = buf; p < buf + len;) {
+                    const inotify_event* ev = reinterpret_cast<const inotify_event*>(p);
+                    p += sizeof(inotify_event) + ev->len;
+                    auto dir = dirs_.find(ev->wd);
+                    if (dir == dirs_.end() || ev->len == 0 || (ev->mask & IN_ISDIR)) continue;
+                    pending[dir->second + "/" + ev->name] = (ev->mask & (IN_DELETE | IN_MOVED_FROM)) != 0;
+                }
+            }
+        }
+    }
+
+    int fd_ = -1;
+    int stopPipe_[2] = { -1, -1 };
+    std::map<int, std::string> dirs_;
+#endif
+
+    Handler handler_;
+    std::function<void()> ready_;
+    std::mutex mutex_;
+    std::vector<Finish> done_;
+    std::thread worker_;
+};
+
+#endif // FILE_WATCHER_H
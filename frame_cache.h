@@ -0,0 +1,123 @@
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * @brief FrameKey Квантованное состояние, полностью определяющее пиксели спрайта в кадре
+ *
+ * Размер вывода округлён до целых пикселей (туда сводятся квантованный breathScale и scale),
+ * смещение тряски и перетаскивания на содержимое не влияет - только на позицию блита.
+ * crop - видимая в окне часть вывода; пока спрайт целиком в окне, это весь вывод.
+ */
+struct FrameKey {
+    int sprite = 0;
+    int frame = 0;
+    int mip = 0;
+    int w = 0;
+    int h = 0;
+    int filter = 0;
+    int cropX = 0, cropY = 0, cropW = 0, cropH = 0;
+
+    bool operator==(const FrameKey&) const = default;
+};
+
+struct FrameKeyHash {
+    size_t operator()(const FrameKey& k) const {
+        uint64_t h = 1469598103934665603ull;
+        for (int v : { k.sprite, k.frame, k.mip, k.w, k.h, k.filter, k.cropX, k.cropY, k.cropW, k.cropH }) {
+            h = (h ^ static_cast<uint32_t>(v)) * 1099511628211ull;
+        }
+        return static_cast<size_t>(h);
+    }
+};
+
+/**
+ * @brief FrameCache LRU готовых кадров с бюджетом по памяти
+ * @tparam Payload Что хранится (у CPU-рендера - блок пикселей)
+ *
+ * onEvict вызывается для каждой вытесненной записи (например, чтобы вернуть буфер в оборот).
+ * Указатели, которые вернули find()/insert(), живут до следующего insert() или clear().
+ */
+template <typename Payload>
+class FrameCache {
+public:
+    explicit FrameCache(size_t budgetBytes, std::function<void(Payload&)> onEvict = {})
+        : budget_(budgetBytes), onEvict_(std::move(onEvict)) {}
+
+    ~FrameCache() { clear(); }
+
+    FrameCache(const FrameCache&) = delete;
+    FrameCache& operator=(const FrameCache&) = delete;
+
+    Payload* find(const FrameKey& key) {
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            ++misses_;
+            return nullptr;
+        }
+        ++hits_;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return &it->second->payload;
+    }
+
+    // Запись больше всего бюджета всё равно вставляется и вытесняется следующей
+    Payload& insert(const FrameKey& key, Payload&& payload, size_t bytes) {
+        auto existing = index_.find(key);
+        if (existing != index_.end()) {
+            evict(existing->second);
+        }
+        while (!lru_.empty() && bytes_ + bytes > budget_) {
+            evict(std::prev(lru_.end()));
+        }
+        lru_.push_front({ key, std::move(payload), bytes });
+        index_[key] = lru_.begin();
+        bytes_ += bytes;
+        return lru_.front().payload;
+    }
+
+    void clear() {
+        while (!lru_.empty()) {
+            evict(std::prev(lru_.end()));
+        }
+    }
+
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+    double hitRate() const {
+        uint64_t total = hits_ + misses_;
+        return total ? static_cast<double>(hits_) / total : 0.0;
+    }
+    size_t bytes() const { return bytes_; }
+    size_t entries() const { return lru_.size(); }
+
+private:
+    struct Entry {
+        FrameKey key;
+        Payload payload;
+        size_t bytes;
+    };
+    using Iter = typename std::list<Entry>::iterator;
+
+    void evict(Iter it) {
+        if (onEvict_) onEvict_(it->payload);
+        bytes_ -= it->bytes;
+        index_.erase(it->key);
+        lru_.erase(it);
+    }
+
+    size_t budget_;
+    size_t bytes_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    std::function<void(Payload&)> onEvict_;
+    std::list<Entry> lru_;
+    std::unordered_map<FrameKey, Iter, FrameKeyHash> index_;
+};
+
+#endif // FRAME_CACHE_H
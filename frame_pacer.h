@@ -0,0 +1,125 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Сводка интервалов между кадрами за последнюю секунду
+struct PacingStats {
+    double meanMs = 0.0;
+    double stddevMs = 0.0;
+    double maxMs = 0.0;
+    int frames = 0;
+    int missed = 0; // дедлайнов, пропущенных больше чем на период
+};
+
+/**
+ * @brief FramePacer Держит цикл на заданной частоте по абсолютным дедлайнам в наносекундах
+ *
+ * Дедлайн каждого кадра - предыдущий плюс период, а не "сейчас плюс период": опоздание
+ * одного кадра не сдвигает все следующие, и средняя частота совпадает с fps.
+ * Ждёт сном до (дедлайн - запас), остаток докручивает в цикле; запас подстраивается
+ * под то, насколько сон системы обычно просыпает.
+ */
+class FramePacer {
+public:
+    void setRate(int fps) {
+        periodNs_ = 1000000000ull / static_cast<Uint64>(std::max(1, fps));
+    }
+
+    Uint64 periodNs() const { return periodNs_; }
+
+    // presented - кадр только что показан с vsync, то есть Present уже дождался экрана:
+    // тогда ждать нечего, отсчёт следующего дедлайна идёт от этого момента
+    void wait(bool presented = false) {
+        Uint64 now = SDL_GetTicksNS();
+        if (deadline_ == 0 || (presented && vsync_)) {
+            deadline_ = now + periodNs_;
+        }
+        else {
+            if (now > deadline_ + periodNs_) {
+                // Отстали больше чем на кадр (окно таскали, система спала) - не догоняем пачкой
+                ++missed_;
+                deadline_ = now;
+            }
+            while (now < deadline_) {
+                const Uint64 left = deadline_ - now;
+                if (left > spinNs_) {
+                    const Uint64 sleep = left - spinNs_;
+                    SDL_DelayNS(sleep);
+                    const Uint64 woke = SDL_GetTicksNS();
+                    adaptSpin(woke - now > sleep ? woke - now - sleep : 0);
+                    now = woke;
+                }
+                else {
+                    now = SDL_GetTicksNS();
+                }
+            }
+            deadline_ += periodNs_;
+        }
+        noteFrame(now);
+    }
+
+    // После простоя: старый дедлайн и интервал до него не в счёт
+    void restart() {
+        deadline_ = 0;
+        lastFrame_ = 0;
+    }
+
+    void setVsync(bool on) { vsync_ = on; }
+    bool vsync() const { return vsync_; }
+
+    const PacingStats& stats() const { return stats_; }
+
+private:
+    static constexpr Uint64 MIN_SPIN_NS = 200000;
+    static constexpr Uint64 MAX_SPIN_NS = 2000000;
+
+    // Запас на докрутку - самое большое недавнее пересыпание плюс немного; старые пики забываются
+    void adaptSpin(Uint64 overshoot) {
+        oversleepNs_ = std::max(overshoot, oversleepNs_ - oversleepNs_ / 16);
+        spinNs_ = std::clamp(oversleepNs_ + oversleepNs_ / 4 + 50000, MIN_SPIN_NS, MAX_SPIN_NS);
+    }
+
+    void noteFrame(Uint64 now) {
+        if (lastFrame_ != 0) {
+            const double ms = (now - lastFrame_) / 1e6;
+            // Welford: среднее и дисперсия за один проход
+            ++count_;
+            const double d = ms - mean_;
+            mean_ += d / count_;
+            m2_ += d * (ms - mean_);
+            maxMs_ = std::max(maxMs_, ms);
+        }
+        lastFrame_ = now;
+        if (windowStart_ == 0) windowStart_ = now;
+        if (now - windowStart_ >= 1000000000ull && count_ > 0) {
+            stats_.meanMs = mean_;
+            stats_.stddevMs = count_ > 1 ? std::sqrt(m2_ / (count_ - 1)) : 0.0;
+            stats_.maxMs = maxMs_;
+            stats_.frames = count_;
+            stats_.missed = missed_;
+            count_ = 0;
+            mean_ = m2_ = maxMs_ = 0.0;
+            missed_ = 0;
+            windowStart_ = now;
+        }
+    }
+
+    Uint64 periodNs_ = 1000000000ull / 60;
+    Uint64 deadline_ = 0;
+    Uint64 spinNs_ = 1000000;
+    Uint64 oversleepNs_ = 0;
+    bool vsync_ = false;
+
+    Uint64 lastFrame_ = 0;
+    Uint64 windowStart_ = 0;
+    int count_ = 0;
+    double mean_ = 0.0, m2_ = 0.0, maxMs_ = 0.0;
+    int missed_ = 0;
+    PacingStats stats_;
+};
+
+#endif // FRAME_PACER_H
@@ -0,0 +1,116 @@
+#ifndef FRAME_STREAM_H
+#define FRAME_STREAM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "sockets.h"
+#include "stage_timing.h"
+
+/**
+ * @brief FrameStream Кодирует кадры в WebP и отправляет их в WebSocket в своём потоке
+ *
+ * Поток владеет контекстом libwebsockets: lws_service, колбэки соединения, кодирование
+ * и lws_write идут только в нём. Рендер отдаёт кадр через submit() - пиксели копируются,
+ * так что медленное кодирование или сокет не держат ни рендер, ни обработку ввода.
+ * Кадр, который поток не успел взять, заменяется следующим: уходит всегда последний.
+ */
+class FrameStream {
+public:
+    FrameStream(lws_context* context, StageTimings* stages)
+        : context_(context), stages_(stages) {}
+
+    ~FrameStream() {
+        if (!worker_.joinable()) return;
+        stop_ = true;
+        lws_cancel_service(context_);
+        worker_.join();
+    }
+
+    // Отдельно от конструктора: колбэки соединения из потока уже должны находить
+    // этот объект через контекст (lws_context_user)
+    void start() {
+        worker_ = std::thread([this]() { workerLoop(); });
+    }
+
+    FrameStream(const FrameStream&) = delete;
+    FrameStream& operator=(const FrameStream&) = delete;
+
+    // Из колбэков libwebsockets, то есть в потоке стрима; nullptr - соединение закрыто
+    void setConnection(lws* wsi) {
+        wsi_ = wsi;
+        connected_.store(wsi != nullptr, std::memory_order_relaxed);
+    }
+
+    // Есть ли кому отправлять: без клиента кадр не стоит ни читать с видеокарты, ни копировать
+    bool connected() const { return connected_.load(std::memory_order_relaxed); }
+
+    // Копирует кадр (RGBA, stride в байтах, 0 - строки подряд) и будит поток
+    void submit(const uint8_t* pixels, int width, int height, int stride = 0) {
+        if (!pixels || width <= 0 || height <= 0) return;
+        const size_t row = static_cast<size_t>(width) * 4;
+        if (stride <= 0) stride = static_cast<int>(row);
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            pending_.resize(row * height);
+            for (int y = 0; y < height; ++y) {
+                std::memcpy(pending_.data() + row * y, pixels + static_cast<size_t>(stride) * y, row);
+            }
+            pendingW_ = width;
+            pendingH_ = height;
+            hasPending_ = true;
+        }
+        lws_cancel_service(context_); // поток может спать в lws_service
+    }
+
+private:
+    // Старые libwebsockets без событий ждут не дольше этого; новые просыпаются по lws_cancel_service
+    static constexpr int SERVICE_TIMEOUT_MS = 50;
+
+    void workerLoop() {
+        while (!stop_) {
+            lws_service(context_, SERVICE_TIMEOUT_MS);
+            int w, h;
+            {
+                std::lock_guard<std::mutex> lk(mutex_);
+                if (!hasPending_) continue;
+                frame_.swap(pending_); // буферы ходят по кругу, память не выделяется заново
+                w = pendingW_;
+                h = pendingH_;
+                hasPending_ = false;
+            }
+            if (!wsi_) continue;
+            bool encoded;
+            {
+                ScopedStageTimer timer(stages_, Stage::Encode);
+                encoded = encodeWebP(frame_.data(), w, h, 0, packet_);
+            }
+            if (!encoded) continue;
+            ScopedStageTimer timer(stages_, Stage::Send);
+            sendPacket(wsi_, packet_);
+        }
+    }
+
+    lws_context* context_;
+    StageTimings* stages_;
+    std::atomic<bool> stop_{ false };
+    std::atomic<bool> connected_{ false };
+
+    // Только поток стрима
+    lws* wsi_ = nullptr;
+    std::vector<uint8_t> frame_;
+    std::vector<unsigned char> packet_;
+
+    std::mutex mutex_;
+    std::vector<uint8_t> pending_;
+    int pendingW_ = 0, pendingH_ = 0;
+    bool hasPending_ = false;
+
+    std::thread worker_;
+};
+
+#endif // FRAME_STREAM_H
@@ -0,0 +1,74 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief LatencyHistogram Гистограмма задержек с шагом BUCKET_US до MAX_MS
+ *
+ * Всё, что дольше MAX_MS, попадает в последнюю корзину. Пишет и читает один поток.
+ */
+class LatencyHistogram {
+public:
+    static constexpr uint64_t BUCKET_US = 250;
+    static constexpr uint64_t MAX_MS = 1000;
+
+    LatencyHistogram() : buckets_(MAX_MS * 1000 / BUCKET_US + 1, 0) {}
+
+    void record(uint64_t ns) {
+        const uint64_t bucket = ns / 1000 / BUCKET_US;
+        ++buckets_[bucket < buckets_.size() ? bucket : buckets_.size() - 1];
+        ++count_;
+        sumNs_ += ns;
+        if (count_ == 1 || ns < minNs_) minNs_ = ns;
+        if (ns > maxNs_) maxNs_ = ns;
+    }
+
+    uint64_t count() const { return count_; }
+    double minMs() const { return minNs_ / 1e6; }
+    double maxMs() const { return maxNs_ / 1e6; }
+    double meanMs() const { return count_ ? sumNs_ / 1e6 / count_ : 0.0; }
+
+    // Верхняя граница корзины, в которую попадает перцентиль p (0..1)
+    double percentileMs(double p) const {
+        if (count_ == 0) return 0.0;
+        const uint64_t rank = static_cast<uint64_t>(p * (count_ - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets_.size(); ++i) {
+            seen += buckets_[i];
+            if (seen >= rank) return (i + 1) * BUCKET_US / 1000.0;
+        }
+        return maxMs();
+    }
+
+    // Сводка и непустые корзины в текстовый файл
+    bool dump(const std::string& path, const char* title) const {
+        std::ofstream out(path);
+        if (!out.is_open()) return false;
+        out << title << '\n'
+            << "samples " << count_ << '\n'
+            << "min " << minMs() << " ms\n"
+            << "mean " << meanMs() << " ms\n"
+            << "p50 " << percentileMs(0.50) << " ms\n"
+            << "p95 " << percentileMs(0.95) << " ms\n"
+            << "p99 " << percentileMs(0.99) << " ms\n"
+            << "max " << maxMs() << " ms\n"
+            << "\nbucket_ms,count\n";
+        for (size_t i = 0; i < buckets_.size(); ++i) {
+            if (buckets_[i]) out << i * BUCKET_US / 1000.0 << ',' << buckets_[i] << '\n';
+        }
+        return true;
+    }
+
+private:
+    std::vector<uint64_t> buckets_;
+    uint64_t count_ = 0;
+    uint64_t sumNs_ = 0;
+    uint64_t minNs_ = 0;
+    uint64_t maxNs_ = 0;
+};
+
+#endif // LATENCY_H
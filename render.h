@@ -1,6 +1,738 @@
 #ifndef RENDER_H
 #define RENDER_H
 
-// потом
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PNGPILL_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define PNGPILL_TARGET_SSE2
+#define PNGPILL_TARGET_AVX2
+#else
+#define PNGPILL_TARGET_SSE2 __attribute__((target("sse2")))
+#define PNGPILL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+using Fixed = int32_t;
+constexpr int FP_SHIFT = 16;
+constexpr Fixed FP_ONE = 1 << FP_SHIFT;
+
+inline Fixed toFixed(float v) {
+    return static_cast<Fixed>(v * FP_ONE + (v >= 0 ? 0.5f : -0.5f));
+}
+
+inline float toFloat(Fixed v) {
+    return static_cast<float>(v) / FP_ONE;
+}
+
+// Формат спрайта с тем же порядком каналов, что и у поверхности окна, но с альфой
+// (у окна обычно XRGB8888, и байт X там под альфу спрайта и отдаём)
+static SDL_PixelFormat spriteFormatFor(SDL_PixelFormat windowFormat) {
+    switch (windowFormat) {
+    case SDL_PIXELFORMAT_XRGB8888: return SDL_PIXELFORMAT_ARGB8888;
+    case SDL_PIXELFORMAT_XBGR8888: return SDL_PIXELFORMAT_ABGR8888;
+    case SDL_PIXELFORMAT_RGBX8888: return SDL_PIXELFORMAT_RGBA8888;
+    case SDL_PIXELFORMAT_BGRX8888: return SDL_PIXELFORMAT_BGRA8888;
+    case SDL_PIXELFORMAT_ARGB8888:
+    case SDL_PIXELFORMAT_ABGR8888:
+    case SDL_PIXELFORMAT_RGBA8888:
+    case SDL_PIXELFORMAT_BGRA8888:
+        return windowFormat;
+    default:
+        return SDL_PIXELFORMAT_ARGB8888;
+    }
+}
+
+/**
+ * @brief BilinearSpan Одна строка назначения, которую надо отсэмплить и смешать
+ *
+ * Источник - предумноженный лист в формате окна (см. spriteFormatFor).
+ * Координаты источника в 16.16, уже сдвинутые на полпикселя (центр пикселя).
+ * row0/row1 - соседние строки источника, fy - вес нижней строки (0..255).
+ * По X выборка зажимается в [minX, maxX], чтобы не цеплять соседнюю четверть листа.
+ */
+struct BilinearSpan {
+    const Uint32* row0 = nullptr;
+    const Uint32* row1 = nullptr;
+    Uint32 fy = 0;
+    Fixed u = 0;
+    Fixed du = FP_ONE;
+    int minX = 0;
+    int maxX = 0;
+    Uint32 alphaMask = 0xFF000000u;
+};
+
+using BlendSpanFn = void (*)(Uint32* dst, int count, const BilinearSpan& s);
+
+// (x + 128) / 255 с правильным округлением для x <= 255 * 255
+static inline Uint32 div255(Uint32 x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Предумноженный источник поверх непрозрачного назначения
+template <int A>
+static inline Uint32 blendPixel(Uint32 src, Uint32 d, Uint32 alphaMask) {
+    Uint32 a = (src >> (A * 8)) & 0xFF;
+    if (a == 0) return d | alphaMask;
+    Uint32 out = 0;
+    for (int c = 0; c < 4; ++c) {
+        int sh = c * 8;
+        Uint32 sc = (src >> sh) & 0xFF;
+        Uint32 dc = (d >> sh) & 0xFF;
+        out |= std::min<Uint32>(255, sc + div255(dc * (255 - a))) << sh;
+    }
+    return out | alphaMask;
+}
+
+template <int A>
+static void blendSpanScalar(Uint32* dst, int count, const BilinearSpan& s) {
+    const Uint32 wy1 = s.fy;
+    const Uint32 wy0 = 256 - wy1;
+    Fixed u = s.u;
+    for (int i = 0; i < count; ++i, u += s.du) {
+        int x0 = u >> FP_SHIFT;
+        Uint32 wx1 = (static_cast<Uint32>(u) >> 8) & 0xFF;
+        Uint32 wx0 = 256 - wx1;
+        int xa = std::clamp(x0, s.minX, s.maxX);
+        int xb = std::clamp(x0 + 1, s.minX, s.maxX);
+
+        Uint32 p00 = s.row0[xa], p10 = s.row0[xb];
+        Uint32 p01 = s.row1[xa], p11 = s.row1[xb];
+
+        Uint32 src = 0;
+        for (int c = 0; c < 4; ++c) {
+            int sh = c * 8;
+            Uint32 top = (((p00 >> sh) & 0xFF) * wx0 + ((p10 >> sh) & 0xFF) * wx1) >> 8;
+            Uint32 bot = (((p01 >> sh) & 0xFF) * wx0 + ((p11 >> sh) & 0xFF) * wx1) >> 8;
+            src |= ((top * wy0 + bot * wy1) >> 8) << sh;
+        }
+
+        dst[i] = blendPixel<A>(src, dst[i], s.alphaMask);
+    }
+}
+
+// Ближайший сосед: берётся только row0, u указывает прямо в центр пикселя (без сдвига на -0.5)
+template <int A>
+static void nearestSpanScalar(Uint32* dst, int count, const BilinearSpan& s) {
+    Fixed u = s.u;
+    for (int i = 0; i < count; ++i, u += s.du) {
+        int x = std::min(std::max(u >> FP_SHIFT, s.minX), s.maxX);
+        dst[i] = blendPixel<A>(s.row0[x], dst[i], s.alphaMask);
+    }
+}
+
+// Масштаб 1:1 - просто смешивание строки источника со строкой назначения
+template <int A>
+static void blendRowScalar(Uint32* dst, const Uint32* src, int count, Uint32 alphaMask) {
+    for (int i = 0; i < count; ++i) {
+        dst[i] = blendPixel<A>(src[i], dst[i], alphaMask);
+    }
+}
+
+/**
+ * @brief BoxSpan Строка назначения для box-фильтра
+ *
+ * u/v - левый/верхний край области пикселя в источнике (16.16), du/dv - её размер.
+ * Каждый пиксель источника входит в сумму с весом, равным площади перекрытия.
+ */
+struct BoxSpan {
+    const Uint32* pixels = nullptr;
+    int pitch = 0; // в пикселях
+    Fixed u = 0, du = FP_ONE;
+    Fixed v = 0, dv = FP_ONE;
+    int minX = 0, maxX = 0;
+    int minY = 0, maxY = 0;
+    Uint32 alphaMask = 0xFF000000u;
+};
+
+template <int A>
+static void boxSpanScalar(Uint32* dst, int count, const BoxSpan& s) {
+    // Веса строк общие для всей строки назначения
+    const int y0 = s.v >> FP_SHIFT;
+    const int y1 = (s.v + s.dv - 1) >> FP_SHIFT;
+    Fixed u = s.u;
+    for (int i = 0; i < count; ++i, u += s.du) {
+        const int x0 = u >> FP_SHIFT;
+        const int x1 = (u + s.du - 1) >> FP_SHIFT;
+        uint64_t acc[4] = { 0, 0, 0, 0 };
+        uint64_t total = 0;
+        for (int sy = y0; sy <= y1; ++sy) {
+            Uint32 wy = static_cast<Uint32>(std::min(s.v + s.dv, (sy + 1) << FP_SHIFT) - std::max(s.v, sy << FP_SHIFT)) >> 8;
+            const Uint32* row = s.pixels + std::clamp(sy, s.minY, s.maxY) * s.pitch;
+            for (int sx = x0; sx <= x1; ++sx) {
+                Uint32 wx = static_cast<Uint32>(std::min(u + s.du, (sx + 1) << FP_SHIFT) - std::max(u, sx << FP_SHIFT)) >> 8;
+                uint64_t w = static_cast<uint64_t>(wx) * wy;
+                Uint32 p = row[std::clamp(sx, s.minX, s.maxX)];
+                acc[0] += (p & 0xFF) * w;
+                acc[1] += ((p >> 8) & 0xFF) * w;
+                acc[2] += ((p >> 16) & 0xFF) * w;
+                acc[3] += (p >> 24) * w;
+                total += w;
+            }
+        }
+        if (total == 0) continue;
+        Uint32 src = 0;
+        for (int c = 0; c < 4; ++c) {
+            src |= static_cast<Uint32>((acc[c] + total / 2) / total) << (c * 8);
+        }
+        dst[i] = blendPixel<A>(src, dst[i], s.alphaMask);
+    }
+}
+
+// Целое увеличение в k раз: каждый пиксель источника повторяется k раз,
+// phase - сколько повторов первого пикселя уже ушло в предыдущий тайл
+template <int A>
+static void blendRowRepeat(Uint32* dst, const Uint32* src, int count, int k, int phase, Uint32 alphaMask) {
+    int i = 0;
+    int rep = phase;
+    while (i < count) {
+        const Uint32 p = *src++;
+        const int n = std::min(k - rep, count - i);
+        for (int j = 0; j < n; ++j, ++i) {
+            dst[i] = blendPixel<A>(p, dst[i], alphaMask);
+        }
+        rep = 0;
+    }
+}
+
+// То же для непрозрачных пикселей: смешивать не с чем, пиксель просто повторяется
+static void copyRowRepeat(Uint32* dst, const Uint32* src, int count, int k, int phase) {
+    int i = 0;
+    int rep = phase;
+    while (i < count) {
+        const Uint32 p = *src++;
+        const int n = std::min(k - rep, count - i);
+        std::fill_n(dst + i, n, p);
+        i += n;
+        rep = 0;
+    }
+}
+
+#ifdef PNGPILL_X86
+
+// Весь блок в 16-битных лейнах: 2 пикселя по 4 канала на 128 бит.
+// Источник предумножен: out = src + dst * (255 - a) / 255
+template <int A>
+PNGPILL_TARGET_SSE2 static inline __m128i blendOverSSE2(__m128i src, __m128i dst) {
+    __m128i a = _mm_shufflelo_epi16(src, _MM_SHUFFLE(A, A, A, A));
+    a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(A, A, A, A));
+    __m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), a);
+    __m128i x = _mm_add_epi16(_mm_mullo_epi16(dst, inv), _mm_set1_epi16(128));
+    x = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    return _mm_add_epi16(src, x);
+}
+
+PNGPILL_TARGET_SSE2 static inline __m128i lerpSSE2(__m128i p0, __m128i p1, __m128i w1) {
+    __m128i w0 = _mm_sub_epi16(_mm_set1_epi16(256), w1);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(p0, w0), _mm_mullo_epi16(p1, w1)), 8);
+}
+
+template <int A>
+PNGPILL_TARGET_SSE2 static void blendSpanSSE2(Uint32* dst, int count, const BilinearSpan& s) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wy = _mm_set1_epi16(static_cast<short>(s.fy));
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(s.alphaMask));
+
+    int i = 0;
+    Fixed u = s.u;
+    for (; i + 4 <= count; i += 4) {
+        alignas(16) Uint32 p00[4], p10[4], p01[4], p11[4];
+        alignas(16) Uint32 wx[4];
+        for (int k = 0; k < 4; ++k, u += s.du) {
+            int x0 = u >> FP_SHIFT;
+            int xa = std::clamp(x0, s.minX, s.maxX);
+            int xb = std::clamp(x0 + 1, s.minX, s.maxX);
+            p00[k] = s.row0[xa]; p10[k] = s.row0[xb];
+            p01[k] = s.row1[xa]; p11[k] = s.row1[xb];
+            Uint32 w = (static_cast<Uint32>(u) >> 8) & 0xFF;
+            wx[k] = w | (w << 16);
+        }
+
+        __m128i w = _mm_load_si128(reinterpret_cast<const __m128i*>(wx));
+        __m128i wLo = _mm_unpacklo_epi32(w, w);
+        __m128i wHi = _mm_unpackhi_epi32(w, w);
+
+        __m128i v00 = _mm_load_si128(reinterpret_cast<const __m128i*>(p00));
+        __m128i v10 = _mm_load_si128(reinterpret_cast<const __m128i*>(p10));
+        __m128i v01 = _mm_load_si128(reinterpret_cast<const __m128i*>(p01));
+        __m128i v11 = _mm_load_si128(reinterpret_cast<const __m128i*>(p11));
+
+        __m128i topLo = lerpSSE2(_mm_unpacklo_epi8(v00, zero), _mm_unpacklo_epi8(v10, zero), wLo);
+        __m128i topHi = lerpSSE2(_mm_unpackhi_epi8(v00, zero), _mm_unpackhi_epi8(v10, zero), wHi);
+        __m128i botLo = lerpSSE2(_mm_unpacklo_epi8(v01, zero), _mm_unpacklo_epi8(v11, zero), wLo);
+        __m128i botHi = lerpSSE2(_mm_unpackhi_epi8(v01, zero), _mm_unpackhi_epi8(v11, zero), wHi);
+        __m128i srcLo = lerpSSE2(topLo, botLo, wy);
+        __m128i srcHi = lerpSSE2(topHi, botHi, wy);
+
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i outLo = blendOverSSE2<A>(srcLo, _mm_unpacklo_epi8(d, zero));
+        __m128i outHi = blendOverSSE2<A>(srcHi, _mm_unpackhi_epi8(d, zero));
+        __m128i out = _mm_or_si128(_mm_packus_epi16(outLo, outHi), alphaMask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), out);
+    }
+
+    if (i < count) {
+        BilinearSpan tail = s;
+        tail.u = u;
+        blendSpanScalar<A>(dst + i, count - i, tail);
+    }
+}
+
+template <int A>
+PNGPILL_TARGET_AVX2 static inline __m256i blendOverAVX2(__m256i src, __m256i dst) {
+    __m256i a = _mm256_shufflelo_epi16(src, _MM_SHUFFLE(A, A, A, A));
+    a = _mm256_shufflehi_epi16(a, _MM_SHUFFLE(A, A, A, A));
+    __m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+    __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(dst, inv), _mm256_set1_epi16(128));
+    x = _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+    return _mm256_add_epi16(src, x);
+}
+
+PNGPILL_TARGET_AVX2 static inline __m256i lerpAVX2(__m256i p0, __m256i p1, __m256i w1) {
+    __m256i w0 = _mm256_sub_epi16(_mm256_set1_epi16(256), w1);
+    return _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(p0, w0), _mm256_mullo_epi16(p1, w1)), 8);
+}
+
+// 8 пикселей за итерацию; индексы и веса считаются в векторе, выборка через gather
+template <int A>
+PNGPILL_TARGET_AVX2 static void blendSpanAVX2(Uint32* dst, int count, const BilinearSpan& s) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i wy = _mm256_set1_epi16(static_cast<short>(s.fy));
+    const __m256i alphaMask = _mm256_set1_epi32(static_cast<int>(s.alphaMask));
+    const __m256i minX = _mm256_set1_epi32(s.minX);
+    const __m256i maxX = _mm256_set1_epi32(s.maxX);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i byteMask = _mm256_set1_epi32(0xFF);
+    const __m256i step = _mm256_set1_epi32(s.du * 8);
+    const int* row0 = reinterpret_cast<const int*>(s.row0);
+    const int* row1 = reinterpret_cast<const int*>(s.row1);
+
+    __m256i u = _mm256_add_epi32(_mm256_set1_epi32(s.u),
+        _mm256_mullo_epi32(_mm256_set1_epi32(s.du), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, u = _mm256_add_epi32(u, step)) {
+        __m256i x0 = _mm256_srai_epi32(u, FP_SHIFT);
+        __m256i xa = _mm256_min_epi32(_mm256_max_epi32(x0, minX), maxX);
+        __m256i xb = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(x0, one), minX), maxX);
+        __m256i w = _mm256_and_si256(_mm256_srli_epi32(u, 8), byteMask);
+        w = _mm256_or_si256(w, _mm256_slli_epi32(w, 16));
+        __m256i wLo = _mm256_unpacklo_epi32(w, w);
+        __m256i wHi = _mm256_unpackhi_epi32(w, w);
+
+        __m256i v00 = _mm256_i32gather_epi32(row0, xa, 4);
+        __m256i v10 = _mm256_i32gather_epi32(row0, xb, 4);
+        __m256i v01 = _mm256_i32gather_epi32(row1, xa, 4);
+        __m256i v11 = _mm256_i32gather_epi32(row1, xb, 4);
+
+        __m256i topLo = lerpAVX2(_mm256_unpacklo_epi8(v00, zero), _mm256_unpacklo_epi8(v10, zero), wLo);
+        __m256i topHi = lerpAVX2(_mm256_unpackhi_epi8(v00, zero), _mm256_unpackhi_epi8(v10, zero), wHi);
+        __m256i botLo = lerpAVX2(_mm256_unpacklo_epi8(v01, zero), _mm256_unpacklo_epi8(v11, zero), wLo);
+        __m256i botHi = lerpAVX2(_mm256_unpackhi_epi8(v01, zero), _mm256_unpackhi_epi8(v11, zero), wHi);
+        __m256i srcLo = lerpAVX2(topLo, botLo, wy);
+        __m256i srcHi = lerpAVX2(topHi, botHi, wy);
+
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i outLo = blendOverAVX2<A>(srcLo, _mm256_unpacklo_epi8(d, zero));
+        __m256i outHi = blendOverAVX2<A>(srcHi, _mm256_unpackhi_epi8(d, zero));
+        __m256i out = _mm256_or_si256(_mm256_packus_epi16(outLo, outHi), alphaMask);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), out);
+    }
+
+    if (i < count) {
+        BilinearSpan tail = s;
+        tail.u = s.u + s.du * i;
+        blendSpanScalar<A>(dst + i, count - i, tail);
+    }
+}
+
+template <int A>
+PNGPILL_TARGET_SSE2 static inline __m128i blendOver4SSE2(__m128i src, __m128i d, __m128i alphaMask) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = blendOverSSE2<A>(_mm_unpacklo_epi8(src, zero), _mm_unpacklo_epi8(d, zero));
+    __m128i hi = blendOverSSE2<A>(_mm_unpackhi_epi8(src, zero), _mm_unpackhi_epi8(d, zero));
+    return _mm_or_si128(_mm_packus_epi16(lo, hi), alphaMask);
+}
+
+template <int A>
+PNGPILL_TARGET_SSE2 static void nearestSpanSSE2(Uint32* dst, int count, const BilinearSpan& s) {
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(s.alphaMask));
+    int i = 0;
+    Fixed u = s.u;
+    for (; i + 4 <= count; i += 4) {
+        alignas(16) Uint32 p[4];
+        for (int k = 0; k < 4; ++k, u += s.du) {
+            p[k] = s.row0[std::min(std::max(u >> FP_SHIFT, s.minX), s.maxX)];
+        }
+        __m128i src = _mm_load_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), blendOver4SSE2<A>(src, d, alphaMask));
+    }
+    if (i < count) {
+        BilinearSpan tail = s;
+        tail.u = u;
+        nearestSpanScalar<A>(dst + i, count - i, tail);
+    }
+}
+
+template <int A>
+PNGPILL_TARGET_SSE2 static void blendRowSSE2(Uint32* dst, const Uint32* src, int count, Uint32 alphaMaskValue) {
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(alphaMaskValue));
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i sv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), blendOver4SSE2<A>(sv, d, alphaMask));
+    }
+    blendRowScalar<A>(dst + i, src + i, count - i, alphaMaskValue);
+}
+
+template <int A>
+PNGPILL_TARGET_AVX2 static inline __m256i blendOver8AVX2(__m256i src, __m256i d, __m256i alphaMask) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = blendOverAVX2<A>(_mm256_unpacklo_epi8(src, zero), _mm256_unpacklo_epi8(d, zero));
+    __m256i hi = blendOverAVX2<A>(_mm256_unpackhi_epi8(src, zero), _mm256_unpackhi_epi8(d, zero));
+    return _mm256_or_si256(_mm256_packus_epi16(lo, hi), alphaMask);
+}
+
+template <int A>
+PNGPILL_TARGET_AVX2 static void nearestSpanAVX2(Uint32* dst, int count, const BilinearSpan& s) {
+    const __m256i alphaMask = _mm256_set1_epi32(static_cast<int>(s.alphaMask));
+    const __m256i minX = _mm256_set1_epi32(s.minX);
+    const __m256i maxX = _mm256_set1_epi32(s.maxX);
+    const __m256i step = _mm256_set1_epi32(s.du * 8);
+    const int* row0 = reinterpret_cast<const int*>(s.row0);
+
+    __m256i u = _mm256_add_epi32(_mm256_set1_epi32(s.u),
+        _mm256_mullo_epi32(_mm256_set1_epi32(s.du), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, u = _mm256_add_epi32(u, step)) {
+        __m256i x = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(u, FP_SHIFT), minX), maxX);
+        __m256i src = _mm256_i32gather_epi32(row0, x, 4);
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), blendOver8AVX2<A>(src, d, alphaMask));
+    }
+    if (i < count) {
+        BilinearSpan tail = s;
+        tail.u = s.u + s.du * i;
+        nearestSpanScalar<A>(dst + i, count - i, tail);
+    }
+}
+
+template <int A>
+PNGPILL_TARGET_AVX2 static void blendRowAVX2(Uint32* dst, const Uint32* src, int count, Uint32 alphaMaskValue) {
+    const __m256i alphaMask = _mm256_set1_epi32(static_cast<int>(alphaMaskValue));
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i sv = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), blendOver8AVX2<A>(sv, d, alphaMask));
+    }
+    blendRowScalar<A>(dst + i, src + i, count - i, alphaMaskValue);
+}
+
+#endif // PNGPILL_X86
+
+// Уровень мипмапы: среднее 2x2 по всем четырём байтам. Для предумноженной альфы
+// это корректная фильтрация, поэтому формат пикселя знать не нужно
+static SDL_Surface* downsampleHalf(const SDL_Surface* src) {
+    const int w = src->w / 2;
+    const int h = src->h / 2;
+    if (w <= 0 || h <= 0) return nullptr;
+
+    SDL_Surface* dst = SDL_CreateSurface(w, h, src->format);
+    if (!dst) return nullptr;
+
+    const int srcPitch = src->pitch / static_cast<int>(sizeof(Uint32));
+    const int dstPitch = dst->pitch / static_cast<int>(sizeof(Uint32));
+    const Uint32* in = static_cast<const Uint32*>(src->pixels);
+    Uint32* out = static_cast<Uint32*>(dst->pixels);
+
+    for (int y = 0; y < h; ++y) {
+        const Uint32* r0 = in + (2 * y) * srcPitch;
+        const Uint32* r1 = r0 + srcPitch;
+        Uint32* o = out + y * dstPitch;
+        for (int x = 0; x < w; ++x) {
+            Uint32 a = r0[2 * x], b = r0[2 * x + 1];
+            Uint32 c = r1[2 * x], d = r1[2 * x + 1];
+            // Чётные и нечётные байты складываются раздельно, чтобы суммы не залезали в соседний канал
+            Uint32 even = (a & 0x00FF00FF) + (b & 0x00FF00FF) + (c & 0x00FF00FF) + (d & 0x00FF00FF) + 0x00020002;
+            Uint32 odd = ((a >> 8) & 0x00FF00FF) + ((b >> 8) & 0x00FF00FF) + ((c >> 8) & 0x00FF00FF) + ((d >> 8) & 0x00FF00FF) + 0x00020002;
+            o[x] = ((even >> 2) & 0x00FF00FF) | (((odd >> 2) & 0x00FF00FF) << 8);
+        }
+    }
+    return dst;
+}
+
+enum class CpuSimdLevel {
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+static CpuSimdLevel detectCpuSimdLevel() {
+#ifdef PNGPILL_X86
+    if (SDL_HasAVX2()) return CpuSimdLevel::AVX2;
+    if (SDL_HasSSE2()) return CpuSimdLevel::SSE2;
+#endif
+    return CpuSimdLevel::Scalar;
+}
+
+static const char* cpuSimdLevelName(CpuSimdLevel level) {
+    switch (level) {
+    case CpuSimdLevel::AVX2: return "AVX2";
+    case CpuSimdLevel::SSE2: return "SSE2";
+    default: return "scalar";
+    }
+}
+
+using BlendRowFn = void (*)(Uint32* dst, const Uint32* src, int count, Uint32 alphaMask);
+using BlendRowRepeatFn = void (*)(Uint32* dst, const Uint32* src, int count, int k, int phase, Uint32 alphaMask);
+using BoxSpanFn = void (*)(Uint32* dst, int count, const BoxSpan& s);
+
+// Набор ядер под конкретный CPU и положение альфы в пикселе
+struct BlendKernels {
+    BlendSpanFn bilinear;
+    BlendSpanFn nearest;
+    BoxSpanFn box;
+    BlendRowFn row;
+    BlendRowRepeatFn rowRepeat;
+};
+
+template <int A>
+static BlendKernels makeBlendKernels(CpuSimdLevel level) {
+    BlendKernels k{ blendSpanScalar<A>, nearestSpanScalar<A>, boxSpanScalar<A>, blendRowScalar<A>, blendRowRepeat<A> };
+#ifdef PNGPILL_X86
+    if (level == CpuSimdLevel::AVX2) {
+        k.bilinear = blendSpanAVX2<A>;
+        k.nearest = nearestSpanAVX2<A>;
+        k.row = blendRowAVX2<A>;
+    }
+    else if (level == CpuSimdLevel::SSE2) {
+        k.bilinear = blendSpanSSE2<A>;
+        k.nearest = nearestSpanSSE2<A>;
+        k.row = blendRowSSE2<A>;
+    }
+#endif
+    (void)level;
+    return k;
+}
+
+// Ядра выбираются по CPU и по тому, в каком байте пикселя лежит альфа
+static const BlendKernels& selectBlendKernels(int alphaShift) {
+    static const CpuSimdLevel level = detectCpuSimdLevel();
+    static const BlendKernels kernels[4] = {
+        makeBlendKernels<0>(level),
+        makeBlendKernels<1>(level),
+        makeBlendKernels<2>(level),
+        makeBlendKernels<3>(level)
+    };
+    return kernels[std::clamp(alphaShift / 8, 0, 3)];
+}
+
+// Поиск непрозрачной области для автоцентровки.
+// Строки сверху и снизу отбрасываются, пока в них нет альфы (ранний выход),
+// столбцы - по OR всех оставшихся строк: одна проверка на столбец вместо четырёх сравнений на пиксель.
+
+static bool alphaRowAnyScalar(const Uint32* row, int count, Uint32 alphaMask) {
+    Uint32 acc = 0;
+    for (int i = 0; i < count; ++i) acc |= row[i];
+    return (acc & alphaMask) != 0;
+}
+
+static void alphaRowOrScalar(Uint32* acc, const Uint32* row, int count) {
+    for (int i = 0; i < count; ++i) acc[i] |= row[i];
+}
+
+// sum += a, sumX += a * x (x - от начала строки)
+static void alphaRowMomentsScalar(const Uint32* row, int count, int alphaShift, uint64_t& sum, uint64_t& sumX) {
+    uint64_t s = 0, sx = 0;
+    for (int i = 0; i < count; ++i) {
+        Uint32 a = (row[i] >> alphaShift) & 0xFF;
+        s += a;
+        sx += static_cast<uint64_t>(a) * i;
+    }
+    sum += s;
+    sumX += sx;
+}
+
+#ifdef PNGPILL_X86
+PNGPILL_TARGET_SSE2 static bool alphaRowAnySSE2(const Uint32* row, int count, Uint32 alphaMask) {
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)));
+    }
+    acc = _mm_and_si128(acc, _mm_set1_epi32(static_cast<int>(alphaMask)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(acc, _mm_setzero_si128())) != 0xFFFF) return true;
+    return alphaRowAnyScalar(row + i, count - i, alphaMask);
+}
+
+PNGPILL_TARGET_SSE2 static void alphaRowOrSSE2(Uint32* acc, const Uint32* row, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i));
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i), _mm_or_si128(a, r));
+    }
+    alphaRowOrScalar(acc + i, row + i, count - i);
+}
+
+// Альфа и x помещаются в 16 бит, поэтому madd_epi16 по 32-битным дорожкам даёт точное a * x
+PNGPILL_TARGET_SSE2 static void alphaRowMomentsSSE2(const Uint32* row, int count, int alphaShift, uint64_t& sum, uint64_t& sumX) {
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    const __m128i shift = _mm_cvtsi32_si128(alphaShift);
+    const __m128i step = _mm_set1_epi32(4);
+    __m128i x = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i s = _mm_setzero_si128();
+    __m128i sx = _mm_setzero_si128();
+    int i = 0;
+    // 32-битные суммы не переполнятся, пока строка не длиннее 4096 пикселей
+    const int limit = std::min(count, 4096);
+    for (; i + 4 <= limit; i += 4) {
+        __m128i a = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)), shift), mask);
+        s = _mm_add_epi32(s, a);
+        sx = _mm_add_epi32(sx, _mm_madd_epi16(a, x));
+        x = _mm_add_epi32(x, step);
+    }
+    alignas(16) Uint32 ls[4], lsx[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(ls), s);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lsx), sx);
+    uint64_t tailSum = 0, tailSumX = 0;
+    alphaRowMomentsScalar(row + i, count - i, alphaShift, tailSum, tailSumX);
+    sum += static_cast<uint64_t>(ls[0]) + ls[1] + ls[2] + ls[3] + tailSum;
+    sumX += static_cast<uint64_t>(lsx[0]) + lsx[1] + lsx[2] + lsx[3] + tailSumX + tailSum * static_cast<uint64_t>(i);
+}
+
+PNGPILL_TARGET_AVX2 static bool alphaRowAnyAVX2(const Uint32* row, int count, Uint32 alphaMask) {
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i)));
+    }
+    if (!_mm256_testz_si256(acc, _mm256_set1_epi32(static_cast<int>(alphaMask)))) return true;
+    return alphaRowAnyScalar(row + i, count - i, alphaMask);
+}
+
+PNGPILL_TARGET_AVX2 static void alphaRowOrAVX2(Uint32* acc, const Uint32* row, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i));
+        __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i), _mm256_or_si256(a, r));
+    }
+    alphaRowOrScalar(acc + i, row + i, count - i);
+}
+
+PNGPILL_TARGET_AVX2 static void alphaRowMomentsAVX2(const Uint32* row, int count, int alphaShift, uint64_t& sum, uint64_t& sumX) {
+    const __m256i mask = _mm256_set1_epi32(0xFF);
+    const __m128i shift = _mm_cvtsi32_si128(alphaShift);
+    const __m256i step = _mm256_set1_epi32(8);
+    __m256i x = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i s = _mm256_setzero_si256();
+    __m256i sx = _mm256_setzero_si256();
+    int i = 0;
+    const int limit = std::min(count, 4096);
+    for (; i + 8 <= limit; i += 8) {
+        __m256i a = _mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i)), shift), mask);
+        s = _mm256_add_epi32(s, a);
+        sx = _mm256_add_epi32(sx, _mm256_madd_epi16(a, x));
+        x = _mm256_add_epi32(x, step);
+    }
+    alignas(32) Uint32 ls[8], lsx[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(ls), s);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lsx), sx);
+    uint64_t tailSum = 0, tailSumX = 0;
+    alphaRowMomentsScalar(row + i, count - i, alphaShift, tailSum, tailSumX);
+    for (int k = 0; k < 8; ++k) {
+        sum += ls[k];
+        sumX += lsx[k];
+    }
+    sum += tailSum;
+    sumX += tailSumX + tailSum * static_cast<uint64_t>(i);
+}
+#endif // PNGPILL_X86
+
+struct AlphaScanKernels {
+    bool (*rowAny)(const Uint32* row, int count, Uint32 alphaMask);
+    void (*rowOr)(Uint32* acc, const Uint32* row, int count);
+    void (*rowMoments)(const Uint32* row, int count, int alphaShift, uint64_t& sum, uint64_t& sumX);
+};
+
+static const AlphaScanKernels& selectAlphaScanKernels() {
+    static const AlphaScanKernels kernels = []() {
+        AlphaScanKernels k{ alphaRowAnyScalar, alphaRowOrScalar, alphaRowMomentsScalar };
+#ifdef PNGPILL_X86
+        CpuSimdLevel level = detectCpuSimdLevel();
+        if (level == CpuSimdLevel::AVX2) k = { alphaRowAnyAVX2, alphaRowOrAVX2, alphaRowMomentsAVX2 };
+        else if (level == CpuSimdLevel::SSE2) k = { alphaRowAnySSE2, alphaRowOrSSE2, alphaRowMomentsSSE2 };
+#endif
+        return k;
+    }();
+    return kernels;
+}
+
+// Границы непрозрачных пикселей в координатах области; minX > maxX - область пустая
+struct AlphaBounds {
+    int minX = 0, maxX = -1;
+    int minY = 0, maxY = -1;
+
+    bool empty() const { return minX > maxX || minY > maxY; }
+};
+
+// pixels - левый верхний угол области w x h, pitch в пикселях
+static AlphaBounds findAlphaBounds(const Uint32* pixels, int pitch, int w, int h, int alphaShift) {
+    const AlphaScanKernels& k = selectAlphaScanKernels();
+    const Uint32 alphaMask = static_cast<Uint32>(0xFF) << alphaShift;
+    AlphaBounds b;
+
+    int top = 0;
+    while (top < h && !k.rowAny(pixels + top * pitch, w, alphaMask)) ++top;
+    if (top == h) return b;
+    int bottom = h - 1;
+    while (bottom > top && !k.rowAny(pixels + bottom * pitch, w, alphaMask)) --bottom;
+
+    std::vector<Uint32> columns(w, 0);
+    for (int y = top; y <= bottom; ++y) {
+        k.rowOr(columns.data(), pixels + y * pitch, w);
+    }
+    int left = 0;
+    while (!(columns[left] & alphaMask)) ++left;
+    int right = w - 1;
+    while (!(columns[right] & alphaMask)) --right;
+
+    b.minX = left;
+    b.maxX = right;
+    b.minY = top;
+    b.maxY = bottom;
+    return b;
+}
+
+// Центр масс по альфе внутри bounds, с точностью до долей пикселя (координаты - индексы пикселей)
+static bool alphaCentroid(const Uint32* pixels, int pitch, const AlphaBounds& b, int alphaShift, float& cx, float& cy) {
+    if (b.empty()) return false;
+    const AlphaScanKernels& k = selectAlphaScanKernels();
+    const int w = b.maxX - b.minX + 1;
+    uint64_t total = 0, momentX = 0;
+    double momentY = 0.0;
+    for (int y = b.minY; y <= b.maxY; ++y) {
+        uint64_t rowSum = 0, rowX = 0;
+        k.rowMoments(pixels + y * pitch + b.minX, w, alphaShift, rowSum, rowX);
+        total += rowSum;
+        momentX += rowX;
+        momentY += static_cast<double>(rowSum) * y;
+    }
+    if (total == 0) return false;
+    cx = static_cast<float>(b.minX + static_cast<double>(momentX) / total);
+    cy = static_cast<float>(momentY / total);
+    return true;
+}
 
 #endif // RENDER_H
@@ -0,0 +1,225 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Двухпроходный (разделимый) ресэмплер: по X, потом по Y.
+// Масштаб одинаков для всего спрайта, поэтому индексы и веса источника
+// считаются один раз на геометрию кадра, а не на каждый пиксель.
+
+enum class ResampleKernel {
+    Triangle,   // билинейный, при уменьшении расширяется на весь след пикселя
+    Bicubic,    // Catmull-Rom (a = -0.5)
+    Lanczos3
+};
+
+constexpr int RESAMPLE_SHIFT = 14;
+constexpr int RESAMPLE_ONE = 1 << RESAMPLE_SHIFT;
+// После горизонтального прохода остаётся 7 дробных бит: вертикальная сумма влезает в int32
+constexpr int RESAMPLE_MID_SHIFT = 7;
+
+static float resampleSupport(ResampleKernel k) {
+    switch (k) {
+    case ResampleKernel::Triangle: return 1.0f;
+    case ResampleKernel::Bicubic:  return 2.0f;
+    default:                       return 3.0f;
+    }
+}
+
+static double resampleWeight(ResampleKernel k, double x) {
+    x = std::fabs(x);
+    switch (k) {
+    case ResampleKernel::Triangle:
+        return x < 1.0 ? 1.0 - x : 0.0;
+    case ResampleKernel::Bicubic: {
+        const double a = -0.5;
+        if (x < 1.0) return ((a + 2.0) * x - (a + 3.0)) * x * x + 1.0;
+        if (x < 2.0) return (((x - 5.0) * x + 8.0) * x - 4.0) * a;
+        return 0.0;
+    }
+    default: {
+        if (x >= 3.0) return 0.0;
+        if (x < 1e-8) return 1.0;
+        const double px = 3.14159265358979323846 * x;
+        return 3.0 * std::sin(px) * std::sin(px / 3.0) / (px * px);
+    }
+    }
+}
+
+/**
+ * @brief ResampleTable Индексы и веса источника для каждого пикселя назначения по одной оси
+ *
+ * Для пикселя i: taps весов (RESAMPLE_SHIFT бит, сумма ровно RESAMPLE_ONE),
+ * начиная с индекса start[i]. Все индексы лежат в [lo, hi] - выборки,
+ * вышедшие за край, отбрасываются с перенормировкой.
+ * Параметры построения хранятся, чтобы не пересчитывать таблицу для той же геометрии.
+ */
+struct ResampleTable {
+    int taps = 0;
+    std::vector<int> start;
+    std::vector<int16_t> weights;
+
+    ResampleKernel kernel = ResampleKernel::Triangle;
+    int lo = 0, hi = -1;
+    int first = 0, count = 0;
+    float origin = 0.0f, scale = 0.0f;
+};
+
+// Пиксель назначения d (first <= d < first + count) имеет центр в источнике
+// lo + (d + 0.5 - origin) * scale
+static void buildResampleTable(ResampleTable& t, ResampleKernel kernel, int lo, int hi,
+                               int first, int count, float origin, float scale) {
+    if (t.kernel == kernel && t.lo == lo && t.hi == hi && t.first == first &&
+        t.count == count && t.origin == origin && t.scale == scale && !t.start.empty()) {
+        return;
+    }
+    t.kernel = kernel;
+    t.lo = lo;
+    t.hi = hi;
+    t.first = first;
+    t.count = count;
+    t.origin = origin;
+    t.scale = scale;
+
+    // При уменьшении ядро растягивается на весь след пикселя назначения
+    const double filterScale = std::max(1.0, static_cast<double>(scale));
+    const double support = resampleSupport(kernel) * filterScale;
+    const int span = hi - lo + 1;
+    t.taps = std::max(1, std::min(span, static_cast<int>(std::ceil(support)) * 2 + 1));
+    t.start.assign(count, lo);
+    t.weights.assign(static_cast<size_t>(count) * t.taps, 0);
+
+    std::vector<double> w(t.taps);
+    for (int i = 0; i < count; ++i) {
+        const double center = lo + (first + i + 0.5 - origin) * scale;
+        int xmin = std::max(lo, static_cast<int>(std::floor(center - support + 0.5)));
+        int xmax = std::min(hi + 1, static_cast<int>(std::floor(center + support + 0.5)));
+        if (xmax - xmin > t.taps) xmax = xmin + t.taps;
+        if (xmax <= xmin) {
+            xmin = std::clamp(static_cast<int>(std::floor(center)), lo, hi);
+            xmax = xmin + 1;
+        }
+
+        // Окно сдвигается внутрь [lo, hi], чтобы все taps выборок были валидны
+        const int start = std::clamp(xmin, lo, hi + 1 - t.taps);
+        std::fill(w.begin(), w.end(), 0.0);
+        double sum = 0.0;
+        for (int x = xmin; x < xmax; ++x) {
+            double v = resampleWeight(kernel, (x + 0.5 - center) / filterScale);
+            w[x - start] = v;
+            sum += v;
+        }
+        if (std::fabs(sum) < 1e-12) {
+            w[std::clamp(static_cast<int>(std::floor(center)), lo, hi) - start] = sum = 1.0;
+        }
+
+        int16_t* out = &t.weights[static_cast<size_t>(i) * t.taps];
+        int total = 0, peak = 0;
+        for (int k = 0; k < t.taps; ++k) {
+            out[k] = static_cast<int16_t>(std::lround(w[k] / sum * RESAMPLE_ONE));
+            total += out[k];
+            if (out[k] > out[peak]) peak = k;
+        }
+        // Ошибку округления отдаём самому тяжёлому весу: сплошной цвет остаётся точным
+        out[peak] = static_cast<int16_t>(out[peak] + RESAMPLE_ONE - total);
+        t.start[i] = start;
+    }
+}
+
+/**
+ * @brief ResampleJob Прямоугольник назначения, который надо отресэмплить
+ *
+ * cols/rows построены для всей области спрайта, colOffset/rowOffset - номер
+ * первого столбца/строки прямоугольника в этих таблицах.
+ * Выход - предумноженные пиксели в порядке каналов источника, alphaByte - индекс байта альфы.
+ */
+struct ResampleJob {
+    const Uint32* pixels = nullptr;
+    int pitch = 0; // в пикселях
+    const ResampleTable* cols = nullptr;
+    const ResampleTable* rows = nullptr;
+    int colOffset = 0, rowOffset = 0;
+    int w = 0, h = 0;
+    int alphaByte = 3;
+};
+
+// Вызывает emit(y, row) для каждой готовой строки прямоугольника (row - w пикселей).
+// Буферы thread_local: на каждый поток по одному, между кадрами не перевыделяются
+template <typename Emit>
+static void resampleSeparable(const ResampleJob& job, Emit&& emit) {
+    const ResampleTable& cols = *job.cols;
+    const ResampleTable& rows = *job.rows;
+    if (job.w <= 0 || job.h <= 0) return;
+
+    const int rowFirst = rows.start[job.rowOffset];
+    const int rowLast = rows.start[job.rowOffset + job.h - 1] + rows.taps - 1;
+    const int rowCount = rowLast - rowFirst + 1;
+    const size_t lineSize = static_cast<size_t>(job.w) * 4;
+
+    thread_local std::vector<int32_t> horizontal;
+    thread_local std::vector<Uint32> line;
+    horizontal.resize(lineSize * rowCount);
+    line.resize(job.w);
+
+    // Горизонтальный проход: только нужные строки источника и только нужные столбцы
+    const int16_t* colWeights = &cols.weights[static_cast<size_t>(job.colOffset) * cols.taps];
+    const int* colStart = &cols.start[job.colOffset];
+    for (int r = 0; r < rowCount; ++r) {
+        const Uint32* src = job.pixels + (rowFirst + r) * job.pitch;
+        int32_t* out = &horizontal[lineSize * r];
+        for (int x = 0; x < job.w; ++x) {
+            const Uint32* s = src + colStart[x];
+            const int16_t* w = colWeights + static_cast<size_t>(x) * cols.taps;
+            int32_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+            for (int k = 0; k < cols.taps; ++k) {
+                const Uint32 p = s[k];
+                c0 += w[k] * static_cast<int32_t>(p & 0xFF);
+                c1 += w[k] * static_cast<int32_t>((p >> 8) & 0xFF);
+                c2 += w[k] * static_cast<int32_t>((p >> 16) & 0xFF);
+                c3 += w[k] * static_cast<int32_t>(p >> 24);
+            }
+            constexpr int shift = RESAMPLE_SHIFT - RESAMPLE_MID_SHIFT;
+            constexpr int32_t round = 1 << (shift - 1);
+            out[x * 4 + 0] = (c0 + round) >> shift;
+            out[x * 4 + 1] = (c1 + round) >> shift;
+            out[x * 4 + 2] = (c2 + round) >> shift;
+            out[x * 4 + 3] = (c3 + round) >> shift;
+        }
+    }
+
+    // Вертикальный проход по готовым строкам
+    constexpr int shift = RESAMPLE_SHIFT + RESAMPLE_MID_SHIFT;
+    constexpr int32_t round = 1 << (shift - 1);
+    const int aShift = job.alphaByte * 8;
+    for (int y = 0; y < job.h; ++y) {
+        const int16_t* w = &rows.weights[static_cast<size_t>(job.rowOffset + y) * rows.taps];
+        const int32_t* base = &horizontal[lineSize * (rows.start[job.rowOffset + y] - rowFirst)];
+        for (int x = 0; x < job.w; ++x) {
+            int32_t c[4] = { 0, 0, 0, 0 };
+            const int32_t* h = base + x * 4;
+            for (int k = 0; k < rows.taps; ++k) {
+                const int32_t* p = h + k * lineSize;
+                c[0] += w[k] * p[0];
+                c[1] += w[k] * p[1];
+                c[2] += w[k] * p[2];
+                c[3] += w[k] * p[3];
+            }
+            // Звон бикубика и Ланцоша может вывести цвет за альфу - для предумноженных это недопустимо
+            const int32_t alpha = std::clamp((c[job.alphaByte] + round) >> shift, 0, 255);
+            Uint32 px = static_cast<Uint32>(alpha) << aShift;
+            for (int ch = 0; ch < 4; ++ch) {
+                if (ch == job.alphaByte) continue;
+                const int32_t v = std::clamp((c[ch] + round) >> shift, 0, alpha);
+                px |= static_cast<Uint32>(v) << (ch * 8);
+            }
+            line[x] = px;
+        }
+        emit(y, line.data());
+    }
+}
+
+#endif // RESAMPLE_H
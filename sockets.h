@@ -5,32 +5,61 @@
 #include <webp/encode.h>
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
+#include <vector>
 
 /**
- * @brief sendWebP Отправляет изображение в формате WebP по WebSocket
- * @param wsi Указатель на WebSocket-соединение (из libwebsockets)
+ * @brief encodeWebP Кодирует изображение в WebP для отправки по WebSocket
  * @param pixels Пиксели в формате RGBA (4 байта на пиксель)
  * @param width Ширина изображения
  * @param height Высота изображения
+ * @param stride Шаг строки в байтах (0 - строки идут подряд, width * 4)
+ * @param packet Сюда кладётся результат; первые LWS_PRE байт оставлены под заголовок libwebsockets.
+ *               Вектор можно переиспользовать между кадрами, чтобы не выделять память заново
  * @return true при успехе
  */
-
-bool sendWebP(struct lws* wsi, const uint8_t* pixels, int width, int height) {
-    if (!wsi || !pixels || width <= 0 || height <= 0) return false;
+bool encodeWebP(const uint8_t* pixels, int width, int height, int stride, std::vector<unsigned char>& packet) {
+    if (!pixels || width <= 0 || height <= 0) return false;
+    if (stride <= 0) stride = width * 4;
     uint8_t* webp_data = nullptr;
-    size_t output_size = WebPEncodeRGBA(pixels, width, height, width * 4, 90.0f, &webp_data);
+    size_t output_size = WebPEncodeRGBA(pixels, width, height, stride, 90.0f, &webp_data);
     if (output_size == 0 || webp_data == nullptr) {
         return false;
     }
 
-    unsigned char* buf = new unsigned char[LWS_PRE + output_size];
-    std::memcpy(buf + LWS_PRE, webp_data, output_size);
+    packet.resize(LWS_PRE + output_size);
+    std::memcpy(packet.data() + LWS_PRE, webp_data, output_size);
     WebPFree(webp_data);
+    return true;
+}
+
+/**
+ * @brief sendPacket Отправляет подготовленный encodeWebP пакет как бинарное сообщение
+ * @param wsi Указатель на WebSocket-соединение (из libwebsockets)
+ * @param packet Данные после первых LWS_PRE байт
+ * @return true, если ушло всё
+ */
+bool sendPacket(struct lws* wsi, std::vector<unsigned char>& packet) {
+    if (!wsi || packet.size() <= LWS_PRE) return false;
+    const size_t size = packet.size() - LWS_PRE;
+    int sent = lws_write(wsi, packet.data() + LWS_PRE, size, LWS_WRITE_BINARY);
+    return (sent == static_cast<int>(size));
+}
 
-    int sent = lws_write(wsi, buf + LWS_PRE, output_size, LWS_WRITE_BINARY);
-    delete[] buf;
+/**
+ * @brief sendWebP Отправляет изображение в формате WebP по WebSocket
+ * @param wsi Указатель на WebSocket-соединение (из libwebsockets)
+ * @param pixels Пиксели в формате RGBA (4 байта на пиксель)
+ * @param width Ширина изображения
+ * @param height Высота изображения
+ * @param stride Шаг строки в байтах (0 - строки идут подряд, width * 4)
+ * @return true при успехе
+ */
 
-    return (sent == static_cast<int>(output_size));
+bool sendWebP(struct lws* wsi, const uint8_t* pixels, int width, int height, int stride = 0) {
+    if (!wsi) return false;
+    std::vector<unsigned char> packet;
+    return encodeWebP(pixels, width, height, stride, packet) && sendPacket(wsi, packet);
 }
 
 static int callback_http(struct lws* wsi, enum lws_callback_reasons reason,
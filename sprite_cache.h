@@ -0,0 +1,395 @@
+#ifndef SPRITE_CACHE_H
+#define SPRITE_CACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Кэш уже декодированных листов рядом с config.ini.
+// Пиксели лежат в файле выровненными по страницам и отображаются в память как есть:
+// ОС подгружает их по мере обращения и делит страницы между запущенными копиями.
+
+/**
+ * @brief MappedFile Файл, отображённый в память только для чтения
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::filesystem::path& path) {
+        close();
+#ifdef _WIN32
+        file_ = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping_) {
+            close();
+            return false;
+        }
+        data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        if (!data_) {
+            close();
+            return false;
+        }
+        size_ = static_cast<size_t>(size.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd); // отображение живёт и без дескриптора
+        if (p == MAP_FAILED) return false;
+        data_ = static_cast<const uint8_t*>(p);
+        size_ = static_cast<size_t>(st.st_size);
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data_) UnmapViewOfFile(data_);
+        if (mapping_) CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    // Отдаёт ОС страницы диапазона: отображение остаётся, при следующем чтении они снова придут из файла
+    void release(const void* p, size_t bytes) const {
+#ifdef _WIN32
+        // Незаблокированные страницы VirtualUnlock убирает из рабочего набора процесса
+        VirtualUnlock(const_cast<void*>(p), bytes);
+#else
+        const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        const uintptr_t from = (reinterpret_cast<uintptr_t>(p) + page - 1) / page * page;
+        const uintptr_t to = (reinterpret_cast<uintptr_t>(p) + bytes) / page * page;
+        if (to > from) madvise(reinterpret_cast<void*>(from), to - from, MADV_DONTNEED);
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#endif
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Исходный PNG; как сверять его с записью кэша - см. matchSpriteSource
+struct SpriteSource {
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = 0;
+
+    bool operator==(const SpriteSource&) const = default;
+};
+
+// Хэш содержимого файла (FNV-1a по 8-байтным словам) - читать сжатый PNG много дешевле, чем распаковывать
+static bool hashFile(const std::filesystem::path& path, uint64_t& hash) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    uint64_t h = 1469598103934665603ull;
+    std::vector<char> buf(1 << 16);
+    while (in) {
+        in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+        size_t got = static_cast<size_t>(in.gcount());
+        size_t i = 0;
+        for (; i + 8 <= got; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, buf.data() + i, 8);
+            h = (h ^ word) * 1099511628211ull;
+        }
+        for (; i < got; ++i) {
+            h = (h ^ static_cast<uint8_t>(buf[i])) * 1099511628211ull;
+        }
+    }
+    hash = h;
+    return true;
+}
+
+// Размер и время изменения; хэш считается отдельно (см. hashFile)
+static bool statSpriteSource(const std::filesystem::path& path, SpriteSource& src) {
+    std::error_code ec;
+    src.path = path.string();
+    src.size = static_cast<uint64_t>(std::filesystem::file_size(path, ec));
+    if (ec) return false;
+    auto time = std::filesystem::last_write_time(path, ec);
+    if (ec) return false;
+    src.mtime = static_cast<int64_t>(time.time_since_epoch().count());
+    return true;
+}
+
+// Совпали путь, размер и время изменения - файл прежний, читать его не нужно.
+// Тот же размер при другом времени (копирование, checkout) решает хэш содержимого;
+// current.hash при совпадении заполняется в любом случае
+static bool matchSpriteSource(const SpriteSource& cached, SpriteSource& current) {
+    if (cached.path != current.path || cached.size != current.size) return false;
+    if (cached.mtime != current.mtime &&
+        (!hashFile(current.path, current.hash) || current.hash != cached.hash)) {
+        return false;
+    }
+    current.hash = cached.hash;
+    return true;
+}
+
+struct SpriteCacheLevel {
+    const void* pixels = nullptr;
+    int w = 0, h = 0;
+    int pitch = 0; // в байтах
+};
+
+// Кадров в листе не больше этого (сетка cols x rows)
+constexpr int SPRITE_CACHE_MAX_FRAMES = 16;
+
+struct SpriteCacheEntry {
+    std::string name;
+    float baseOffsetX[SPRITE_CACHE_MAX_FRAMES] = {};
+    float baseOffsetY[SPRITE_CACHE_MAX_FRAMES] = {};
+    std::vector<SpriteCacheLevel> levels; // 0 - сам лист, дальше мипы
+};
+
+/**
+ * @brief SpriteCache Файл кэша листов: заголовок с описанием, потом пиксели
+ *
+ * Годится, только если совпали формат пикселей, режим центровки и весь список
+ * исходников (путь, размер, mtime, хэш) в том же порядке. Иначе open() возвращает false,
+ * листы декодируются заново и кэш перезаписывается целиком.
+ */
+class SpriteCache {
+public:
+    static constexpr uint32_t VERSION = 2;
+    static constexpr size_t PAGE = 4096;
+
+    // sources - размер и время исходников (statSpriteSource); хэш дописывается при совпадении
+    bool open(const std::filesystem::path& path, uint32_t format, uint32_t alignment,
+              std::vector<SpriteSource>& sources) {
+        entries_.clear();
+        if (!file_.open(path)) return false;
+
+        Reader r{ file_.data(), file_.size() };
+        char magic[8];
+        uint32_t version = 0, fileFormat = 0, fileAlignment = 0, count = 0;
+        if (!r.bytes(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(magic)) != 0 ||
+            !r.pod(version) || version != VERSION ||
+            !r.pod(fileFormat) || fileFormat != format ||
+            !r.pod(fileAlignment) || fileAlignment != alignment ||
+            !r.pod(count) || count != sources.size()) {
+            return fail();
+        }
+
+        entries_.resize(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            SpriteSource src;
+            SpriteCacheEntry& e = entries_[i];
+            uint32_t levelCount = 0;
+            if (!r.str(src.path) || !r.pod(src.size) || !r.pod(src.mtime) || !r.pod(src.hash) ||
+                !matchSpriteSource(src, sources[i]) ||
+                !r.str(e.name) || !r.bytes(e.baseOffsetX, sizeof(e.baseOffsetX)) ||
+                !r.bytes(e.baseOffsetY, sizeof(e.baseOffsetY)) || !r.pod(levelCount) || levelCount == 0 || levelCount > 32) {
+                return fail();
+            }
+            e.levels.resize(levelCount);
+            for (SpriteCacheLevel& level : e.levels) {
+                int32_t w = 0, h = 0, pitch = 0;
+                uint64_t offset = 0;
+                if (!r.pod(w) || !r.pod(h) || !r.pod(pitch) || !r.pod(offset) ||
+                    w <= 0 || h <= 0 || pitch < w * 4 ||
+                    offset > file_.size() || static_cast<uint64_t>(pitch) * h > file_.size() - offset) {
+                    return fail();
+                }
+                level.pixels = file_.data() + offset;
+                level.w = w;
+                level.h = h;
+                level.pitch = pitch;
+            }
+        }
+        return true;
+    }
+
+    const std::vector<SpriteCacheEntry>& entries() const { return entries_; }
+
+    // Выгруженный лист не должен занимать память процесса, хотя его отображение остаётся
+    void release(size_t entry) const {
+        for (const SpriteCacheLevel& level : entries_[entry].levels) {
+            file_.release(level.pixels, static_cast<size_t>(level.pitch) * level.h);
+        }
+    }
+
+    // Пишет во временный файл и подменяет им старый, чтобы оборванная запись не оставила битый кэш
+    static bool write(const std::filesystem::path& path, uint32_t format, uint32_t alignment,
+                      const std::vector<SpriteSource>& sources, const std::vector<SpriteCacheEntry>& entries) {
+        if (sources.size() != entries.size()) return false;
+
+        std::vector<uint64_t> offsets;
+        std::string header = serializeHeader(format, alignment, sources, entries, offsets);
+        uint64_t pos = alignUp(header.size());
+        offsets.clear();
+        for (const SpriteCacheEntry& e : entries) {
+            for (const SpriteCacheLevel& level : e.levels) {
+                offsets.push_back(pos);
+                pos = alignUp(pos + static_cast<uint64_t>(level.w) * 4 * level.h);
+            }
+        }
+        header = serializeHeader(format, alignment, sources, entries, offsets);
+
+        std::filesystem::path tmp = path;
+        tmp += ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out) return false;
+            out.write(header.data(), static_cast<std::streamsize>(header.size()));
+            size_t k = 0;
+            for (const SpriteCacheEntry& e : entries) {
+                for (const SpriteCacheLevel& level : e.levels) {
+                    pad(out, offsets[k++]);
+                    const uint8_t* row = static_cast<const uint8_t*>(level.pixels);
+                    for (int y = 0; y < level.h; ++y, row += level.pitch) {
+                        out.write(reinterpret_cast<const char*>(row), static_cast<std::streamsize>(level.w) * 4);
+                    }
+                }
+            }
+            pad(out, pos);
+            if (!out) return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr char MAGIC[8] = { 'P', 'N', 'G', 'P', 'I', 'L', 'L', 'C' };
+
+    struct Reader {
+        const uint8_t* data;
+        size_t size;
+        size_t pos = 0;
+
+        bool bytes(void* dst, size_t n) {
+            if (n > size - pos) return false;
+            std::memcpy(dst, data + pos, n);
+            pos += n;
+            return true;
+        }
+        template <typename T>
+        bool pod(T& v) { return bytes(&v, sizeof(T)); }
+        bool str(std::string& s) {
+            uint32_t n = 0;
+            if (!pod(n) || n > size - pos) return false;
+            s.assign(reinterpret_cast<const char*>(data + pos), n);
+            pos += n;
+            return true;
+        }
+    };
+
+    bool fail() {
+        entries_.clear();
+        file_.close();
+        return false;
+    }
+
+    static uint64_t alignUp(uint64_t v) { return (v + PAGE - 1) / PAGE * PAGE; }
+
+    static void pad(std::ofstream& out, uint64_t to) {
+        static const char zeros[PAGE] = {};
+        uint64_t at = static_cast<uint64_t>(out.tellp());
+        while (at < to) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(to - at, PAGE));
+            out.write(zeros, static_cast<std::streamsize>(n));
+            at += n;
+        }
+    }
+
+    template <typename T>
+    static void put(std::string& s, const T& v) { s.append(reinterpret_cast<const char*>(&v), sizeof(T)); }
+    static void putStr(std::string& s, const std::string& v) {
+        put(s, static_cast<uint32_t>(v.size()));
+        s.append(v);
+    }
+
+    // Смещения пикселей пока не известны - первый проход с нулями только ради размера заголовка
+    static std::string serializeHeader(uint32_t format, uint32_t alignment,
+                                       const std::vector<SpriteSource>& sources,
+                                       const std::vector<SpriteCacheEntry>& entries,
+                                       const std::vector<uint64_t>& offsets) {
+        std::string s(MAGIC, sizeof(MAGIC));
+        put(s, VERSION);
+        put(s, format);
+        put(s, alignment);
+        put(s, static_cast<uint32_t>(entries.size()));
+        size_t k = 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const SpriteSource& src = sources[i];
+            const SpriteCacheEntry& e = entries[i];
+            putStr(s, src.path);
+            put(s, src.size);
+            put(s, src.mtime);
+            put(s, src.hash);
+            putStr(s, e.name);
+            s.append(reinterpret_cast<const char*>(e.baseOffsetX), sizeof(e.baseOffsetX));
+            s.append(reinterpret_cast<const char*>(e.baseOffsetY), sizeof(e.baseOffsetY));
+            put(s, static_cast<uint32_t>(e.levels.size()));
+            for (const SpriteCacheLevel& level : e.levels) {
+                put(s, static_cast<int32_t>(level.w));
+                put(s, static_cast<int32_t>(level.h));
+                put(s, static_cast<int32_t>(level.w * 4)); // в файле строки без выравнивания
+                put(s, k < offsets.size() ? offsets[k] : uint64_t{ 0 });
+                ++k;
+            }
+        }
+        return s;
+    }
+
+    MappedFile file_;
+    std::vector<SpriteCacheEntry> entries_;
+};
+
+#endif // SPRITE_CACHE_H
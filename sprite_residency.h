@@ -0,0 +1,175 @@
+#ifndef SPRITE_RESIDENCY_H
+#define SPRITE_RESIDENCY_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief SpriteResidency Учёт памяти листов спрайтов и их фоновая подгрузка
+ *
+ * Сам ничего не знает о пикселях: хранит для каждого листа размер, время последнего
+ * использования и состояние. Загрузка - задача, которая выполняется в отдельном потоке
+ * и возвращает функцию-завершение; завершения выполняются в потоке, вызвавшем poll()
+ * (главном), потому что текстуры SDL можно создавать только там. Завершение может так
+ * и не выполниться (выход из программы) - тогда оно просто разрушается.
+ */
+class SpriteResidency {
+public:
+    using Finish = std::function<void()>;
+    using Job = std::function<Finish()>;
+
+    // ready вызывается в потоке загрузки, когда появилось что выполнить в poll()
+    SpriteResidency(size_t budgetBytes, size_t count, std::function<void()> ready = nullptr)
+        : budget_(budgetBytes), slots_(count), ready_(std::move(ready)) {
+        worker_ = std::thread([this]() { workerLoop(); });
+    }
+
+    ~SpriteResidency() {
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        worker_.join();
+        // Завершения, до которых poll() не дошёл, держат готовые листы: задача отдаёт
+        // результат так, чтобы при разрушении он сам освободил свои пиксели
+        jobs_.clear();
+        done_.clear();
+    }
+
+    SpriteResidency(const SpriteResidency&) = delete;
+    SpriteResidency& operator=(const SpriteResidency&) = delete;
+
+    void touch(size_t i) { slots_[i].lastUse = ++clock_; }
+
+    void markResident(size_t i, size_t bytes) {
+        Slot& s = slots_[i];
+        if (s.state == State::Resident) total_ -= s.bytes;
+        s.state = State::Resident;
+        s.bytes = bytes;
+        ++s.generation;
+        total_ += bytes;
+    }
+
+    void markEvicted(size_t i) {
+        Slot& s = slots_[i];
+        if (s.state == State::Resident) total_ -= s.bytes;
+        s.state = State::Evicted;
+        s.bytes = 0;
+        ++s.generation;
+    }
+
+    // Новый лист (появился после запуска) - сразу в памяти
+    void add(size_t bytes) {
+        slots_.emplace_back();
+        slots_.back().lastUse = ++clock_;
+        markResident(slots_.size() - 1, bytes);
+    }
+
+    bool isResident(size_t i) const { return slots_[i].state == State::Resident; }
+    bool isLoading(size_t i) const { return slots_[i].state == State::Loading; }
+
+    // Растёт при каждом markResident/markEvicted. Загрузка запоминает его в load(), и если к
+    // завершению оно другое, лист успели заменить или удалить - результат надо выбросить
+    uint64_t generation(size_t i) const { return slots_[i].generation; }
+
+    // Ставит лист в очередь фоновой загрузки, если его нет в памяти и он ещё не грузится
+    void load(size_t i, Job job) {
+        if (slots_[i].state != State::Evicted) return;
+        slots_[i].state = State::Loading;
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            jobs_.push_back(std::move(job));
+        }
+        wake_.notify_one();
+    }
+
+    // Выполняет завершения готовых загрузок; завершение само вызывает markResident/markEvicted
+    void poll() {
+        std::vector<Finish> done;
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            done.swap(done_);
+        }
+        for (Finish& f : done) {
+            if (f) f();
+        }
+    }
+
+    // Листы, которые надо выгрузить (давно не использованные первыми), чтобы уложиться в бюджет.
+    // pinned не выгружаются никогда, даже если без них бюджет не выполнить
+    std::vector<size_t> overBudget(const std::vector<size_t>& pinned) const {
+        std::vector<size_t> victims;
+        size_t total = total_;
+        while (total > budget_) {
+            size_t best = slots_.size();
+            for (size_t i = 0; i < slots_.size(); ++i) {
+                const Slot& s = slots_[i];
+                if (s.state != State::Resident || contains(pinned, i) || contains(victims, i)) continue;
+                if (best == slots_.size() || s.lastUse < slots_[best].lastUse) best = i;
+            }
+            if (best == slots_.size()) break;
+            victims.push_back(best);
+            total -= slots_[best].bytes;
+        }
+        return victims;
+    }
+
+    size_t bytes() const { return total_; }
+    size_t budget() const { return budget_; }
+
+private:
+    enum class State { Resident, Evicted, Loading };
+
+    struct Slot {
+        State state = State::Resident;
+        size_t bytes = 0;
+        uint64_t lastUse = 0;
+        uint64_t generation = 0;
+    };
+
+    static bool contains(const std::vector<size_t>& list, size_t i) {
+        for (size_t v : list) if (v == i) return true;
+        return false;
+    }
+
+    void workerLoop() {
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lk(mutex_);
+                wake_.wait(lk, [&]() { return stop_ || !jobs_.empty(); });
+                if (stop_) return;
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+            Finish finish = job();
+            {
+                std::lock_guard<std::mutex> lk(mutex_);
+                done_.push_back(std::move(finish));
+            }
+            if (ready_) ready_();
+        }
+    }
+
+    size_t budget_;
+    size_t total_ = 0;
+    uint64_t clock_ = 0;
+    std::vector<Slot> slots_;
+    std::function<void()> ready_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<Job> jobs_;
+    std::vector<Finish> done_;
+    bool stop_ = false;
+    std::thread worker_;
+};
+
+#endif // SPRITE_RESIDENCY_H
@@ -0,0 +1,314 @@
+#ifndef STAGE_TIMING_H
+#define STAGE_TIMING_H
+
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Этапы кадра: первые три - в потоке симуляции, encode и send - в потоке стрима, остальные - в потоке отрисовки
+enum class Stage : uint8_t {
+    Events,
+    Audio,
+    Breathing,
+    Raster,
+    Readback,
+    Encode,
+    Send,
+    Present,
+    Count
+};
+
+constexpr int STAGE_COUNT = static_cast<int>(Stage::Count);
+
+static const char* const STAGE_NAMES[STAGE_COUNT] = {
+    "events", "audio", "breathing", "raster", "readback", "encode", "send", "present"
+};
+
+// Сводка этапа за одно окно
+struct StageSummary {
+    uint64_t count = 0;
+    double minMs = 0.0;
+    double avgMs = 0.0;
+    double p99Ms = 0.0;
+    double maxMs = 0.0;
+};
+
+/**
+ * @brief StageHistogram Лог-линейная гистограмма длительностей без блокировок
+ *
+ * Корзины по 8 на каждое удвоение (погрешность перцентиля до 12.5%), начиная с 256 нс.
+ * Пишет один поток - тот, что выполняет этап; читать можно из любого. Корзины и сумма
+ * только растут, окно считается разностью двух снимков; min и max забирает читатель.
+ */
+class StageHistogram {
+public:
+    static constexpr int BUCKETS = 256;
+
+    struct Snapshot {
+        uint64_t buckets[BUCKETS] = {};
+        uint64_t count = 0;
+        uint64_t sumNs = 0;
+    };
+
+    void record(uint64_t ns) {
+        buckets_[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        sumNs_.fetch_add(ns, std::memory_order_relaxed);
+        // CAS, а не load/store: читатель в любой момент может сбросить min и max
+        uint64_t cur = minNs_.load(std::memory_order_relaxed);
+        while (ns < cur && !minNs_.compare_exchange_weak(cur, ns, std::memory_order_relaxed)) {}
+        cur = maxNs_.load(std::memory_order_relaxed);
+        while (ns > cur && !maxNs_.compare_exchange_weak(cur, ns, std::memory_order_relaxed)) {}
+    }
+
+    void snapshot(Snapshot& s) const {
+        s.count = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            s.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+            s.count += s.buckets[i];
+        }
+        s.sumNs = sumNs_.load(std::memory_order_relaxed);
+    }
+
+    // min и max с прошлого вызова; вызывает один читатель
+    void takeExtremes(uint64_t& minNs, uint64_t& maxNs) {
+        minNs = minNs_.exchange(UINT64_MAX, std::memory_order_relaxed);
+        maxNs = maxNs_.exchange(0, std::memory_order_relaxed);
+    }
+
+    static int bucketOf(uint64_t ns) {
+        const uint64_t u = ns >> UNIT_SHIFT;
+        if (u < SUB) return static_cast<int>(u);
+        const int msb = 63 - std::countl_zero(u);
+        const int b = ((msb - SUB_BITS + 1) << SUB_BITS) + static_cast<int>((u >> (msb - SUB_BITS)) & (SUB - 1));
+        return std::min(b, BUCKETS - 1);
+    }
+
+    // Нижняя граница корзины в наносекундах
+    static uint64_t bucketLowNs(int b) {
+        if (b < static_cast<int>(SUB)) return static_cast<uint64_t>(b) << UNIT_SHIFT;
+        const int msb = (b >> SUB_BITS) + SUB_BITS - 1;
+        const uint64_t u = (uint64_t{ 1 } << msb) | (static_cast<uint64_t>(b & (SUB - 1)) << (msb - SUB_BITS));
+        return u << UNIT_SHIFT;
+    }
+
+private:
+    static constexpr int UNIT_SHIFT = 8; // 256 нс
+    static constexpr int SUB_BITS = 3;
+    static constexpr uint64_t SUB = 1u << SUB_BITS;
+
+    std::atomic<uint64_t> buckets_[BUCKETS] = {};
+    std::atomic<uint64_t> sumNs_{ 0 };
+    std::atomic<uint64_t> minNs_{ UINT64_MAX };
+    std::atomic<uint64_t> maxNs_{ 0 };
+};
+
+/**
+ * @brief StageTimings Гистограммы всех этапов и сводки по окнам
+ *
+ * record() - из потока этапа; collect() - из одного потока (симуляции).
+ */
+class StageTimings {
+public:
+    void record(Stage stage, uint64_t ns) { hist_[static_cast<int>(stage)].record(ns); }
+
+    // Сводки за время с прошлого вызова
+    void collect(StageSummary out[STAGE_COUNT]) {
+        StageHistogram::Snapshot now;
+        for (int i = 0; i < STAGE_COUNT; ++i) {
+            hist_[i].snapshot(now);
+            uint64_t minNs, maxNs;
+            hist_[i].takeExtremes(minNs, maxNs);
+            StageSummary& s = out[i];
+            s = StageSummary{};
+            s.count = now.count - prev_[i].count;
+            if (s.count > 0) {
+                s.minMs = minNs == UINT64_MAX ? 0.0 : minNs / 1e6;
+                s.maxMs = maxNs / 1e6;
+                s.avgMs = (now.sumNs - prev_[i].sumNs) / 1e6 / s.count;
+                // Верхняя граница корзины перцентиля, но не выше настоящего максимума
+                const uint64_t rank = static_cast<uint64_t>(0.99 * (s.count - 1)) + 1;
+                uint64_t seen = 0;
+                for (int b = 0; b < StageHistogram::BUCKETS; ++b) {
+                    seen += now.buckets[b] - prev_[i].buckets[b];
+                    if (seen >= rank) {
+                        s.p99Ms = std::min(StageHistogram::bucketLowNs(b + 1) / 1e6, s.maxMs);
+                        break;
+                    }
+                }
+            }
+            prev_[i] = now;
+        }
+    }
+
+private:
+    StageHistogram hist_[STAGE_COUNT];
+    StageHistogram::Snapshot prev_[STAGE_COUNT];
+};
+
+/**
+ * @brief StageLogWriter Пишет сводки этапов в файл в своём потоке
+ *
+ * Поток симуляции только кладёт окно в очередь (push). Открытие, запись и ротация файла
+ * идут здесь; файл держится открытым между окнами и сбрасывается после каждой пачки.
+ * Путь, .json - JSON Lines (объект на строку), иначе CSV. Файл больше MAX_LOG_BYTES
+ * переименовывается в <путь>.1, прежний .1 удаляется.
+ */
+class StageLogWriter {
+public:
+    static constexpr uintmax_t MAX_LOG_BYTES = 4u << 20;
+
+    StageLogWriter() {
+        worker_ = std::thread([this]() { workerLoop(); });
+    }
+
+    // Дописывает очередь до конца
+    ~StageLogWriter() {
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        worker_.join();
+    }
+
+    StageLogWriter(const StageLogWriter&) = delete;
+    StageLogWriter& operator=(const StageLogWriter&) = delete;
+
+    // Другой путь закрывает прежний файл; если файл не открылся, путь пропускается до смены
+    void push(const std::string& path, const StageSummary s[STAGE_COUNT], uint64_t timeMs) {
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            Window& w = queue_.emplace_back();
+            w.path = path;
+            std::copy(s, s + STAGE_COUNT, w.stages);
+            w.timeMs = timeMs;
+        }
+        wake_.notify_one();
+    }
+
+private:
+    struct Window {
+        std::string path;
+        StageSummary stages[STAGE_COUNT];
+        uint64_t timeMs = 0;
+    };
+
+    void workerLoop() {
+        for (;;) {
+            std::deque<Window> batch;
+            {
+                std::unique_lock<std::mutex> lk(mutex_);
+                wake_.wait(lk, [&]() { return stop_ || !queue_.empty(); });
+                if (queue_.empty()) return;
+                batch.swap(queue_);
+            }
+            for (const Window& w : batch) write(w);
+            if (out_.is_open()) out_.flush();
+        }
+    }
+
+    void write(const Window& w) {
+        if (w.path != path_) {
+            out_.close();
+            path_ = w.path;
+            failed_ = false;
+        }
+        if (failed_) return;
+        if (out_.is_open() && bytes_ > MAX_LOG_BYTES) out_.close();
+        if (!out_.is_open() && !open()) {
+            std::cerr << "Failed to write stage timings to " << path_ << '\n';
+            failed_ = true;
+            return;
+        }
+
+        std::ostringstream line;
+        const StageSummary* s = w.stages;
+        if (json_) {
+            line << "{\"t_ms\":" << w.timeMs;
+            for (int i = 0; i < STAGE_COUNT; ++i) {
+                line << ",\"" << STAGE_NAMES[i] << "\":{\"count\":" << s[i].count << ",\"min\":" << s[i].minMs
+                     << ",\"avg\":" << s[i].avgMs << ",\"p99\":" << s[i].p99Ms << ",\"max\":" << s[i].maxMs << '}';
+            }
+            line << "}\n";
+        }
+        else {
+            for (int i = 0; i < STAGE_COUNT; ++i) {
+                if (s[i].count == 0) continue;
+                line << w.timeMs << ',' << STAGE_NAMES[i] << ',' << s[i].count << ',' << s[i].minMs << ','
+                     << s[i].avgMs << ',' << s[i].p99Ms << ',' << s[i].maxMs << '\n';
+            }
+        }
+        const std::string text = line.str();
+        out_ << text;
+        bytes_ += text.size();
+    }
+
+    bool open() {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        uintmax_t size = fs::file_size(path_, ec);
+        if (ec) size = 0;
+        if (size > MAX_LOG_BYTES) {
+            fs::remove(path_ + ".1", ec); // на Windows rename не заменяет существующий файл
+            fs::rename(path_, path_ + ".1", ec);
+            size = 0;
+        }
+        out_.open(path_, std::ios::app);
+        if (!out_.is_open()) return false;
+        json_ = fs::path(path_).extension() == ".json";
+        bytes_ = size;
+        if (!json_ && size == 0) {
+            static const char header[] = "t_ms,stage,count,min_ms,avg_ms,p99_ms,max_ms\n";
+            out_ << header;
+            bytes_ += sizeof(header) - 1;
+        }
+        return true;
+    }
+
+    // Только поток записи
+    std::ofstream out_;
+    std::string path_;
+    uintmax_t bytes_ = 0;
+    bool json_ = false;
+    bool failed_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<Window> queue_;
+    bool stop_ = false;
+    std::thread worker_;
+};
+
+/**
+ * @brief ScopedStageTimer Меряет время жизни области и пишет его в этап; nullptr - не мерить
+ */
+class ScopedStageTimer {
+public:
+    ScopedStageTimer(StageTimings* timings, Stage stage)
+        : timings_(timings), stage_(stage), start_(timings ? SDL_GetTicksNS() : 0) {}
+
+    ~ScopedStageTimer() {
+        if (timings_) timings_->record(stage_, SDL_GetTicksNS() - start_);
+    }
+
+    ScopedStageTimer(const ScopedStageTimer&) = delete;
+    ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+private:
+    StageTimings* timings_;
+    Stage stage_;
+    Uint64 start_;
+};
+
+#endif // STAGE_TIMING_H
@@ -0,0 +1,158 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief ThreadPool Постоянный пул потоков с воровством задач
+ *
+ * Потоки создаются один раз. run() раскладывает индексы задач по очередям
+ * слотов непрерывными блоками (соседние тайлы остаются у одного потока),
+ * освободившийся поток ворует задачи с хвоста чужих очередей.
+ * Вызывающий поток работает как слот 0, поэтому рабочих потоков на один меньше.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int threads) {
+        if (threads == 0) threads = 1;
+        for (unsigned int i = 0; i < threads; ++i) {
+            queues_.push_back(std::make_unique<Queue>());
+        }
+        for (unsigned int i = 1; i < threads; ++i) {
+            workers_.emplace_back([this, i]() { workerLoop(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& th : workers_) {
+            th.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int size() const { return static_cast<unsigned int>(queues_.size()); }
+
+    // Выполняет fn(i) для всех i из [0, count) и возвращается, когда всё готово.
+    // Не реентерабельно: fn не должна сама вызывать run().
+    void run(size_t count, const std::function<void(size_t)>& fn) {
+        if (count == 0) return;
+        if (workers_.empty() || count == 1) {
+            for (size_t i = 0; i < count; ++i) fn(i);
+            return;
+        }
+
+        job_.store(&fn, std::memory_order_release);
+        pending_.store(count, std::memory_order_release);
+
+        const size_t slots = queues_.size();
+        for (size_t s = 0; s < slots; ++s) {
+            std::lock_guard<std::mutex> lk(queues_[s]->m);
+            size_t begin = count * s / slots;
+            size_t end = count * (s + 1) / slots;
+            for (size_t i = begin; i < end; ++i) {
+                queues_[s]->items.push_back(i);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            ++generation_;
+        }
+        wake_.notify_all();
+
+        work(0);
+
+        std::unique_lock<std::mutex> lk(mutex_);
+        done_.wait(lk, [&]() { return pending_.load(std::memory_order_acquire) == 0 && active_ == 0; });
+        job_.store(nullptr, std::memory_order_relaxed);
+    }
+
+private:
+    struct Queue {
+        std::mutex m;
+        std::deque<size_t> items;
+    };
+
+    bool pop(size_t slot, size_t& task) {
+        Queue& q = *queues_[slot];
+        std::lock_guard<std::mutex> lk(q.m);
+        if (q.items.empty()) return false;
+        task = q.items.front();
+        q.items.pop_front();
+        return true;
+    }
+
+    bool steal(size_t slot, size_t& task) {
+        const size_t slots = queues_.size();
+        for (size_t k = 1; k < slots; ++k) {
+            Queue& q = *queues_[(slot + k) % slots];
+            std::lock_guard<std::mutex> lk(q.m);
+            if (q.items.empty()) continue;
+            task = q.items.back();
+            q.items.pop_back();
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_t slot) {
+        size_t task;
+        while (pop(slot, task) || steal(slot, task)) {
+            (*job_.load(std::memory_order_acquire))(task);
+            if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lk(mutex_);
+                done_.notify_all();
+            }
+        }
+    }
+
+    void workerLoop(size_t slot) {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lk(mutex_);
+                wake_.wait(lk, [&]() { return stop_ || generation_ != seen; });
+                if (stop_) return;
+                seen = generation_;
+                ++active_;
+            }
+            work(slot);
+            {
+                std::lock_guard<std::mutex> lk(mutex_);
+                --active_;
+            }
+            done_.notify_all();
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    uint64_t generation_ = 0;
+    unsigned int active_ = 0;
+    bool stop_ = false;
+
+    std::atomic<const std::function<void(size_t)>*> job_{ nullptr };
+    std::atomic<size_t> pending_{ 0 };
+};
+
+#endif // THREAD_POOL_H
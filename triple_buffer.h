@@ -0,0 +1,51 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief TripleBuffer Передача последнего значения от одного писателя одному читателю без блокировок
+ *
+ * У писателя и читателя по своему слоту, третий - между ними. Писатель заполняет back()
+ * и меняет его местами со средним; читатель забирает средний, только если там новое.
+ * Никто никого не ждёт: промежуточные значения, которые читатель не успел взять, теряются.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+    // Слот писателя; после заполнения - publish()
+    T& back() { return slots_[back_]; }
+
+    void publish() {
+        back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX;
+        sequence_.fetch_add(1, std::memory_order_release);
+        sequence_.notify_one();
+    }
+
+    // Забирает последнее опубликованное; false - нового нет, front() прежний
+    bool acquire() {
+        if ((middle_.load(std::memory_order_relaxed) & FRESH) == 0) return false;
+        front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    // Слот читателя
+    const T& front() const { return slots_[front_]; }
+
+    // Номер последней публикации и ожидание следующей после seen
+    uint32_t sequence() const { return sequence_.load(std::memory_order_acquire); }
+    void wait(uint32_t seen) const { sequence_.wait(seen, std::memory_order_acquire); }
+
+private:
+    static constexpr uint32_t INDEX = 3;
+    static constexpr uint32_t FRESH = 4;
+
+    T slots_[3]{};
+    uint32_t back_ = 0;  // только писатель
+    uint32_t front_ = 1; // только читатель
+    alignas(64) std::atomic<uint32_t> middle_{ 2 };
+    std::atomic<uint32_t> sequence_{ 0 };
+};
+
+#endif // TRIPLE_BUFFER_H
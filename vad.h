@@ -0,0 +1,163 @@
+#ifndef VAD_H
+#define VAD_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include "render.h"
+
+// Сумма квадратов сэмплов - основа RMS каждого шага детектора
+static float sumSquaresScalar(const float* x, int n) {
+    float s = 0.0f;
+    for (int i = 0; i < n; ++i) s += x[i] * x[i];
+    return s;
+}
+
+#ifdef PNGPILL_X86
+
+PNGPILL_TARGET_SSE2 static float sumSquaresSSE2(const float* x, int n) {
+    __m128 acc = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(x + i);
+        acc = _mm_add_ps(acc, _mm_mul_ps(v, v));
+    }
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sumSquaresScalar(x + i, n - i);
+}
+
+PNGPILL_TARGET_AVX2 static float sumSquaresAVX2(const float* x, int n) {
+    __m256 acc = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(x + i);
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(v, v));
+    }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, acc);
+    float s = 0.0f;
+    for (float l : lanes) s += l;
+    return s + sumSquaresScalar(x + i, n - i);
+}
+
+#endif // PNGPILL_X86
+
+using SumSquaresFn = float (*)(const float* x, int n);
+
+static SumSquaresFn selectSumSquares() {
+#ifdef PNGPILL_X86
+    switch (detectCpuSimdLevel()) {
+    case CpuSimdLevel::AVX2: return sumSquaresAVX2;
+    case CpuSimdLevel::SSE2: return sumSquaresSSE2;
+    default: break;
+    }
+#endif
+    return sumSquaresScalar;
+}
+
+/**
+ * @brief VadParams Настройки детектора голоса (все, кроме hopMs, можно менять на лету)
+ *
+ * threshold - порог включения по огибающей; выключение - при threshold * hysteresis.
+ * С autoCalibrate порог не опускается ниже noiseMargin * уровень шума.
+ */
+struct VadParams {
+    float threshold = 0.0075f;
+    float gain = 1.0f;
+    float hysteresis = 0.6f;
+    float attackMs = 5.0f;
+    float releaseMs = 60.0f;
+    int hopMs = 5;
+    bool autoCalibrate = false;
+    float noiseMargin = 3.0f;
+};
+
+/**
+ * @brief VoiceDetector Потоковый детектор: RMS шага -> огибающая атака/спад -> гистерезис
+ *
+ * Работает в потоке анализа звука; наружу отдаёт атомарные снимки состояния.
+ * Задержка открытия рта ограничена шагом и атакой, а не частотой кадров.
+ */
+class VoiceDetector {
+public:
+    VoiceDetector() : sumSquares_(selectSumSquares()) {}
+
+    void configure(const VadParams& p) {
+        threshold_.store(p.threshold, std::memory_order_relaxed);
+        gain_.store(p.gain, std::memory_order_relaxed);
+        hysteresis_.store(std::clamp(p.hysteresis, 0.0f, 1.0f), std::memory_order_relaxed);
+        attackMs_.store(std::max(0.0f, p.attackMs), std::memory_order_relaxed);
+        releaseMs_.store(std::max(0.0f, p.releaseMs), std::memory_order_relaxed);
+        autoCalibrate_.store(p.autoCalibrate, std::memory_order_relaxed);
+        noiseMargin_.store(std::max(1.0f, p.noiseMargin), std::memory_order_relaxed);
+    }
+
+    // Один шаг (hop) сэмплов; hopMs - его длительность, captureNs - когда был захвачен его конец
+    void process(const float* x, int n, float hopMs, uint64_t captureNs = 0) {
+        if (n <= 0) return;
+        const float gain = 2.0f * (1.0f + gain_.load(std::memory_order_relaxed));
+        const float rms = std::sqrt(sumSquares_(x, n) / n) * gain;
+
+        auto coeff = [hopMs](float ms) { return ms <= 0.0f ? 1.0f : 1.0f - std::exp(-hopMs / ms); };
+        const float k = rms > envelope_ ? coeff(attackMs_.load(std::memory_order_relaxed))
+                                        : coeff(releaseMs_.load(std::memory_order_relaxed));
+        envelope_ += (rms - envelope_) * k;
+
+        // Шум оценивается только в паузах: вниз быстро, вверх медленно (несколько секунд)
+        if (!speaking_) {
+            if (noiseFloor_ < 0.0f) noiseFloor_ = rms;
+            else if (rms < noiseFloor_) noiseFloor_ += (rms - noiseFloor_) * 0.5f;
+            else noiseFloor_ += (rms - noiseFloor_) * coeff(NOISE_RISE_MS);
+        }
+
+        float on = threshold_.load(std::memory_order_relaxed);
+        if (autoCalibrate_.load(std::memory_order_relaxed)) {
+            on = std::max(on, noiseFloor_ * noiseMargin_.load(std::memory_order_relaxed));
+        }
+        const float off = on * hysteresis_.load(std::memory_order_relaxed);
+        if (!speaking_ && envelope_ > on) {
+            speaking_ = true;
+            onsetNs_.store(captureNs, std::memory_order_relaxed);
+        }
+        else if (speaking_ && envelope_ < off) speaking_ = false;
+
+        level_.store(envelope_, std::memory_order_relaxed);
+        floor_.store(std::max(0.0f, noiseFloor_), std::memory_order_relaxed);
+        speakingOut_.store(speaking_, std::memory_order_release);
+    }
+
+    bool speaking() const { return speakingOut_.load(std::memory_order_acquire); }
+    float level() const { return level_.load(std::memory_order_relaxed); }
+    float noiseFloor() const { return floor_.load(std::memory_order_relaxed); }
+    // Время захвата звука, на котором детектор последний раз включился (0 - неизвестно)
+    uint64_t onsetNs() const { return onsetNs_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr float NOISE_RISE_MS = 3000.0f;
+
+    SumSquaresFn sumSquares_;
+
+    // Состояние потока анализа
+    float envelope_ = 0.0f;
+    float noiseFloor_ = -1.0f;
+    bool speaking_ = false;
+
+    // Настройки (пишет главный поток)
+    std::atomic<float> threshold_{ 0.0075f };
+    std::atomic<float> gain_{ 1.0f };
+    std::atomic<float> hysteresis_{ 0.6f };
+    std::atomic<float> attackMs_{ 5.0f };
+    std::atomic<float> releaseMs_{ 60.0f };
+    std::atomic<bool> autoCalibrate_{ false };
+    std::atomic<float> noiseMargin_{ 3.0f };
+
+    // Снимки для главного потока
+    std::atomic<bool> speakingOut_{ false };
+    std::atomic<float> level_{ 0.0f };
+    std::atomic<float> floor_{ 0.0f };
+    std::atomic<uint64_t> onsetNs_{ 0 };
+};
+
+#endif // VAD_H
@@ -0,0 +1,215 @@
+#ifndef VISEME_H
+#define VISEME_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "render.h"
+
+// Форма рта по спектру голоса. Гласные различаются двумя нижними формантами:
+// А - высокая F1 и средняя F2, Э/И - низкая F1 и высокая F2, О/У - обе низкие.
+// Точные частоты формант по короткому окну не нужны: хватает энергии в полосах вокруг них.
+
+enum class Viseme : uint8_t {
+    Rest,  // рот закрыт
+    Open,  // А
+    Wide,  // Э, И
+    Round  // О, У
+};
+
+// Один этап бабочек radix-2: пары (a, a + half), поворотные множители этапа подряд
+static void fftStageScalar(float* re, float* im, int n, int half, const float* wr, const float* wi) {
+    for (int start = 0; start < n; start += 2 * half) {
+        for (int k = 0; k < half; ++k) {
+            const int a = start + k, b = a + half;
+            const float tr = re[b] * wr[k] - im[b] * wi[k];
+            const float ti = re[b] * wi[k] + im[b] * wr[k];
+            re[b] = re[a] - tr;
+            im[b] = im[a] - ti;
+            re[a] += tr;
+            im[a] += ti;
+        }
+    }
+}
+
+#ifdef PNGPILL_X86
+
+PNGPILL_TARGET_SSE2 static void fftStageSSE2(float* re, float* im, int n, int half, const float* wr, const float* wi) {
+    if (half < 4) {
+        fftStageScalar(re, im, n, half, wr, wi);
+        return;
+    }
+    for (int start = 0; start < n; start += 2 * half) {
+        for (int k = 0; k < half; k += 4) {
+            const int a = start + k, b = a + half;
+            const __m128 cr = _mm_loadu_ps(wr + k), ci = _mm_loadu_ps(wi + k);
+            const __m128 br = _mm_loadu_ps(re + b), bi = _mm_loadu_ps(im + b);
+            const __m128 ar = _mm_loadu_ps(re + a), ai = _mm_loadu_ps(im + a);
+            const __m128 tr = _mm_sub_ps(_mm_mul_ps(br, cr), _mm_mul_ps(bi, ci));
+            const __m128 ti = _mm_add_ps(_mm_mul_ps(br, ci), _mm_mul_ps(bi, cr));
+            _mm_storeu_ps(re + b, _mm_sub_ps(ar, tr));
+            _mm_storeu_ps(im + b, _mm_sub_ps(ai, ti));
+            _mm_storeu_ps(re + a, _mm_add_ps(ar, tr));
+            _mm_storeu_ps(im + a, _mm_add_ps(ai, ti));
+        }
+    }
+}
+
+PNGPILL_TARGET_AVX2 static void fftStageAVX2(float* re, float* im, int n, int half, const float* wr, const float* wi) {
+    if (half < 8) {
+        fftStageSSE2(re, im, n, half, wr, wi);
+        return;
+    }
+    for (int start = 0; start < n; start += 2 * half) {
+        for (int k = 0; k < half; k += 8) {
+            const int a = start + k, b = a + half;
+            const __m256 cr = _mm256_loadu_ps(wr + k), ci = _mm256_loadu_ps(wi + k);
+            const __m256 br = _mm256_loadu_ps(re + b), bi = _mm256_loadu_ps(im + b);
+            const __m256 ar = _mm256_loadu_ps(re + a), ai = _mm256_loadu_ps(im + a);
+            const __m256 tr = _mm256_sub_ps(_mm256_mul_ps(br, cr), _mm256_mul_ps(bi, ci));
+            const __m256 ti = _mm256_add_ps(_mm256_mul_ps(br, ci), _mm256_mul_ps(bi, cr));
+            _mm256_storeu_ps(re + b, _mm256_sub_ps(ar, tr));
+            _mm256_storeu_ps(im + b, _mm256_sub_ps(ai, ti));
+            _mm256_storeu_ps(re + a, _mm256_add_ps(ar, tr));
+            _mm256_storeu_ps(im + a, _mm256_add_ps(ai, ti));
+        }
+    }
+}
+
+#endif // PNGPILL_X86
+
+using FftStageFn = void (*)(float* re, float* im, int n, int half, const float* wr, const float* wi);
+
+static FftStageFn selectFftStage() {
+#ifdef PNGPILL_X86
+    switch (detectCpuSimdLevel()) {
+    case CpuSimdLevel::AVX2: return fftStageAVX2;
+    case CpuSimdLevel::SSE2: return fftStageSSE2;
+    default: break;
+    }
+#endif
+    return fftStageScalar;
+}
+
+/**
+ * @brief VisemeClassifier Окно Ханна -> БПФ на FFT_SIZE точек -> энергия формантных полос -> визема
+ *
+ * Все буферы выделяются в конструкторе; process() не выделяет память.
+ * Пишет и читает один поток (поток анализа звука).
+ */
+class VisemeClassifier {
+public:
+    static constexpr int FFT_SIZE = 256;
+
+    explicit VisemeClassifier(int sampleRate)
+        : stage_(selectFftStage()), window_(FFT_SIZE), bitrev_(FFT_SIZE), twRe_(FFT_SIZE - 1), twIm_(FFT_SIZE - 1),
+          re_(FFT_SIZE), im_(FFT_SIZE) {
+        constexpr double pi = 3.14159265358979323846;
+        for (int i = 0; i < FFT_SIZE; ++i) {
+            window_[i] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * pi * i / (FFT_SIZE - 1)));
+            int r = 0;
+            for (int bit = 1, rbit = FFT_SIZE >> 1; bit < FFT_SIZE; bit <<= 1, rbit >>= 1) {
+                if (i & bit) r |= rbit;
+            }
+            bitrev_[i] = r;
+        }
+        // Множители этапа с half бабочками лежат с индекса half - 1
+        for (int half = 1; half < FFT_SIZE; half <<= 1) {
+            for (int k = 0; k < half; ++k) {
+                twRe_[half - 1 + k] = static_cast<float>(std::cos(-pi * k / half));
+                twIm_[half - 1 + k] = static_cast<float>(std::sin(-pi * k / half));
+            }
+        }
+        const float binHz = static_cast<float>(sampleRate) / FFT_SIZE;
+        auto bin = [binHz](float hz) { return std::clamp(static_cast<int>(hz / binHz + 0.5f), 1, FFT_SIZE / 2); };
+        lowBegin_ = bin(LOW_HZ);
+        midBegin_ = bin(MID_HZ);
+        highBegin_ = bin(HIGH_HZ);
+        highEnd_ = bin(TOP_HZ);
+        binHz_ = binHz;
+    }
+
+    // Сбрасывает сглаживание между фразами
+    void reset() {
+        low_ = mid_ = high_ = centroid_ = 0.0f;
+        primed_ = false;
+        candidate_ = current_ = Viseme::Open;
+        stable_ = 0;
+    }
+
+    // x - последние FFT_SIZE сэмплов по порядку; вызывается только пока детектор слышит голос
+    Viseme process(const float* x) {
+        // Предыскажение поднимает верха, иначе F2 теряется под F1 и гармониками основного тона
+        float prev = x[0];
+        for (int i = 0; i < FFT_SIZE; ++i) {
+            const float v = x[i] - PRE_EMPHASIS * prev;
+            prev = x[i];
+            re_[bitrev_[i]] = v * window_[i];
+            im_[bitrev_[i]] = 0.0f;
+        }
+        for (int half = 1; half < FFT_SIZE; half <<= 1) {
+            stage_(re_.data(), im_.data(), FFT_SIZE, half, twRe_.data() + half - 1, twIm_.data() + half - 1);
+        }
+
+        float low = 0.0f, mid = 0.0f, high = 0.0f, moment = 0.0f;
+        for (int k = lowBegin_; k < highEnd_; ++k) {
+            const float p = re_[k] * re_[k] + im_[k] * im_[k];
+            if (k < midBegin_) low += p;
+            else if (k < highBegin_) mid += p;
+            else high += p;
+            if (k < highBegin_) moment += p * k;
+        }
+
+        // Сглаживание по времени: одно окно - это доля слога
+        const float a = primed_ ? SMOOTHING : 1.0f;
+        primed_ = true;
+        low_ += (low - low_) * a;
+        mid_ += (mid - mid_) * a;
+        high_ += (high - high_) * a;
+        const float formant = low + mid;
+        if (formant > 0.0f) centroid_ += (moment / formant * binHz_ - centroid_) * a;
+
+        const float total = low_ + mid_ + high_;
+        if (total <= 0.0f) return current_;
+        Viseme v;
+        if (high_ / total > WIDE_HIGH_SHARE) v = Viseme::Wide;
+        else if (centroid_ < ROUND_CENTROID_HZ) v = Viseme::Round;
+        else v = Viseme::Open;
+
+        // Смена формы только после HOLD окон подряд, иначе рот дрожит на переходах
+        if (v != candidate_) {
+            candidate_ = v;
+            stable_ = 0;
+        }
+        if (v != current_ && ++stable_ >= HOLD) current_ = v;
+        return current_;
+    }
+
+private:
+    static constexpr float LOW_HZ = 200.0f;   // F1
+    static constexpr float MID_HZ = 900.0f;   // F2 задних гласных и верх F1 у А
+    static constexpr float HIGH_HZ = 1700.0f; // F2 передних гласных
+    static constexpr float TOP_HZ = 3500.0f;
+    static constexpr float PRE_EMPHASIS = 0.95f;
+    static constexpr float SMOOTHING = 0.5f;
+    static constexpr float WIDE_HIGH_SHARE = 0.3f;
+    static constexpr float ROUND_CENTROID_HZ = 850.0f;
+    static constexpr int HOLD = 2;
+
+    FftStageFn stage_;
+    std::vector<float> window_;
+    std::vector<int> bitrev_;
+    std::vector<float> twRe_, twIm_;
+    std::vector<float> re_, im_;
+    int lowBegin_ = 1, midBegin_ = 1, highBegin_ = 1, highEnd_ = 1;
+    float binHz_ = 1.0f;
+
+    float low_ = 0.0f, mid_ = 0.0f, high_ = 0.0f, centroid_ = 0.0f;
+    bool primed_ = false;
+    Viseme candidate_ = Viseme::Open;
+    Viseme current_ = Viseme::Open;
+    int stable_ = 0;
+};
+
+#endif // VISEME_H